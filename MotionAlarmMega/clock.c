@@ -0,0 +1,98 @@
+/*
+ * clock.c
+ *
+ * Millisecond system clock on timer 5.
+ */ 
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "clock.h"
+#include "latency.h"
+
+volatile uint32_t clockMilliseconds = 0;
+static void (*clockTick)(void) = 0;
+
+// Timer 5 compare ISR, runs every millisecond. Only the count is kept
+// atomic, the tick function runs with interrupts back on and this vector
+// masked so it can't hold off the echo capture (see latency.h).
+ISR(TIMER5_COMPA_vect)
+{
+	clockMilliseconds++;
+	latencyStamp(LATENCY_CLOCK, TCNT5L);
+	if (clockTick)
+	{
+		TIMSK5 &= ~(1 << OCIE5A);
+		latencyRelease(LATENCY_CLOCK, TCNT5L);
+		sei();
+		clockTick();
+		cli();
+		TIMSK5 |= (1 << OCIE5A);
+	}
+	else
+	{
+		latencyRelease(LATENCY_CLOCK, TCNT5L);
+	}
+}
+
+// Start timer 5 in CTC mode with a prescaler of 64. The tick function is
+// called from the ISR every millisecond, so it has to be short.
+void
+clockInit(void (*tick)(void))
+{
+	clockTick = tick;
+	TCCR5A = 0;
+	TCCR5B = 0;
+	TCNT5 = 0;
+	OCR5A = CLOCK_TOP;
+	TIMSK5 |= (1 << OCIE5A);
+	TCCR5B = (1 << WGM52) | (1 << CS51) | (1 << CS50);
+	return;
+}
+
+// Get the milliseconds since clockInit(). The 32 bit counter can't be read
+// in one instruction, so the ISR is kept out while copying it.
+uint32_t
+clockMillis(void)
+{
+	uint32_t now;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		now = clockMilliseconds;
+	}
+	return now;
+}
+
+// Get the microseconds since clockInit() with a 4 us resolution
+uint32_t
+clockMicros(void)
+{
+	uint32_t now;
+	uint16_t ticks;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		now = clockMilliseconds;
+		ticks = TCNT5;
+		// The counter has already restarted if a match is still waiting
+		// for the ISR
+		if ((TIFR5 & (1 << OCF5A)) && ticks < CLOCK_TOP / 2)
+		{
+			now += 1;
+		}
+	}
+	return now * 1000 + ticks * CLOCK_US_PER_TICK;
+}
+
+// Get a deadline the given number of milliseconds from now
+uint32_t
+deadlineIn(uint32_t ms)
+{
+	return clockMillis() + ms;
+}
+
+// Check if a deadline has been reached
+uint8_t
+deadlinePassed(uint32_t deadline)
+{
+	return (int32_t) (clockMillis() - deadline) >= 0;
+}
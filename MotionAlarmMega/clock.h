@@ -0,0 +1,28 @@
+/*
+ * clock.h
+ *
+ * Monotonic system clock from timer 5 in CTC mode with a 1 ms tick. The
+ * 32 bit millisecond counter wraps after about 49 days, deadlines are
+ * compared with signed differences so they keep working across the wrap as
+ * long as they are less than 24 days away.
+ */ 
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+#define CLOCK_TOP 249	// 16 MHz / 64 / 250 = 1 kHz
+#define CLOCK_US_PER_TICK 4	// Timer 5 counts in 4 us steps within a millisecond
+
+// Milliseconds since clockInit(), use clockMillis() unless interrupts are
+// already off
+extern volatile uint32_t clockMilliseconds;
+
+void clockInit(void (*tick)(void));
+uint32_t clockMillis(void);
+uint32_t clockMicros(void);
+uint32_t deadlineIn(uint32_t ms);
+uint8_t deadlinePassed(uint32_t deadline);
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ * echo.c
+ *
+ * Echo capture on INT5 and timer 4.
+ */ 
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "hal.h"
+#include "echo.h"
+#include "latency.h"
+
+static volatile uint8_t echoCaptured = ECHO_DONE;
+static volatile uint16_t echoRiseAt = 0;
+static volatile uint16_t echoFallAt = 0;
+
+// INT5 on any edge. The count is taken first and interrupts stay off, see
+// latency.h.
+ISR(INT5_vect)
+{
+	uint16_t now = TCNT4;
+	uint8_t start = TCNT5L;
+#if LATENCY_GPIO
+	PINB = (1 << PB7);
+#endif
+	uint8_t high = halEcho();
+	if (high && echoCaptured == ECHO_WAITING)
+	{
+		echoRiseAt = now;
+		echoCaptured = ECHO_HIGH;
+	}
+	else if (!high && echoCaptured == ECHO_HIGH)
+	{
+		echoFallAt = now;
+		echoCaptured = ECHO_DONE;
+	}
+	latencyHold(LATENCY_ECHO, start);
+}
+
+// Interrupt on both edges of the echo pin, timer 4 has to be running
+void
+echoInit(void)
+{
+	EICRB = (EICRB & ~(1 << ISC51)) | (1 << ISC50);
+	EIFR = (1 << INTF5);
+	EIMSK |= (1 << INT5);
+#if LATENCY_GPIO
+	DDRB |= (1 << PB7);
+#endif
+	return;
+}
+
+// Restart timer 4 and wait for a new echo, before triggering the sensor
+void
+echoArm(void)
+{
+	uint8_t sreg = halInterruptsSave();
+	halEchoTimerReset();
+	EIFR = (1 << INTF5);
+	echoCaptured = ECHO_WAITING;
+	halInterruptsRestore(sreg);
+	return;
+}
+
+uint8_t
+echoState(void)
+{
+	return echoCaptured;
+}
+
+// Get the timer 4 count at the rising edge, once the state is ECHO_HIGH.
+// It isn't written again until the next echoArm(), so no need to keep the
+// handler out while reading it.
+uint16_t
+echoRise(void)
+{
+	return echoRiseAt;
+}
+
+// Get the echo width in timer 4 ticks, once the state is ECHO_DONE
+uint16_t
+echoWidth(void)
+{
+	return echoFallAt - echoRiseAt;
+}
@@ -0,0 +1,29 @@
+/*
+ * echo.h
+ *
+ * Echo capture of the ultrasonic sensor on INT5 (PE5). The handler takes
+ * the timer 4 count on both edges of the echo, so the width no longer
+ * depends on how often the main code looks at the pin. It has the highest
+ * priority of the interrupt policy in latency.h.
+ *
+ * echoArm() restarts timer 4 and waits for a rising edge, then a falling
+ * one. Edges in any other order are ignored until the next echoArm().
+ */ 
+
+#ifndef ECHO_H
+#define ECHO_H
+
+#include <stdint.h>
+
+// Capture states, in the order they are reached
+#define ECHO_WAITING 0	// Armed, no edge yet
+#define ECHO_HIGH 1	// Rising edge taken
+#define ECHO_DONE 2	// Falling edge taken, the width is ready
+
+void echoInit(void);
+void echoArm(void);
+uint8_t echoState(void);
+uint16_t echoRise(void);
+uint16_t echoWidth(void);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * hal.h
+ *
+ * Hardware the logic in main.c and pin.c touches: the link and debug
+ * USARTs, the ultrasonic sensor pins, the echo timer, the cycle counter,
+ * the EEPROM and the keypad. On the AVR every call is an inline register
+ * access, so nothing is added to the firmware. Other compilers only get
+ * the prototypes, a host build supplies them with fake hardware behind
+ * (see host/mega).
+ */ 
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include "link.h"
+
+#ifdef __AVR__
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "keypad/keypad.h"
+
+#define HAL_TRIGGER_PIN PE4
+#define HAL_ECHO_PIN PE5
+#define HAL_BUZZER_PIN PE3
+
+// _delay_us() needs a constant, so this can't be a function
+#define halDelayUs(us) _delay_us(us)
+
+static inline void
+halInterruptsOn(void)
+{
+	sei();
+}
+
+// Turn interrupts off and get what to restore
+static inline uint8_t
+halInterruptsSave(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	return sreg;
+}
+
+static inline void
+halInterruptsRestore(uint8_t sreg)
+{
+	SREG = sreg;
+}
+
+// USART1 to the atmega328p, 8 data bits, 1 stop bit, no parity. Received
+// bytes and frames to send are queued for the interrupts in link.c.
+static inline void
+halLinkInit(uint16_t ubrr, uint8_t doubleSpeed)
+{
+	UBRR1H = (uint8_t) (ubrr >> 8);
+	UBRR1L = (uint8_t) ubrr;
+	UCSR1A = doubleSpeed ? (1 << U2X1) : 0;
+	UCSR1B = (1 << TXEN1) | (1 << RXEN1) | (1 << RXCIE1);
+	UCSR1C = (1 << UCSZ11) | (1 << UCSZ10);
+}
+
+// Queue a frame from linkFrames, it goes back to the pool once sent
+static inline void
+halLinkSend(struct linkFrame *frame)
+{
+	linkFrameQueuePush(&linkSending, frame);
+	uint8_t sreg = halInterruptsSave();
+	UCSR1B |= (1 << UDRIE1);
+	halInterruptsRestore(sreg);
+}
+
+static inline uint8_t
+halLinkReadable(void)
+{
+	return linkQueueCount(&linkReceived) != 0;
+}
+
+static inline uint8_t
+halLinkRead(void)
+{
+	uint8_t data = 0;
+	linkQueuePop(&linkReceived, &data);
+	return data;
+}
+
+// USART0 to the USB serial port
+static inline void
+halDebugInit(uint16_t ubrr, uint8_t doubleSpeed)
+{
+	UBRR0H = (uint8_t) (ubrr >> 8);
+	UBRR0L = (uint8_t) ubrr;
+	UCSR0A = doubleSpeed ? (1 << U2X0) : 0;
+	UCSR0B = (1 << TXEN0) | (1 << RXEN0);
+	UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+}
+
+static inline uint8_t
+halDebugWritable(void)
+{
+	return (UCSR0A & (1 << UDRE0)) != 0;
+}
+
+static inline void
+halDebugWrite(uint8_t data)
+{
+	UDR0 = data;
+}
+
+static inline uint8_t
+halDebugReadable(void)
+{
+	return (UCSR0A & (1 << RXC0)) != 0;
+}
+
+static inline uint8_t
+halDebugRead(void)
+{
+	return UDR0;
+}
+
+// Ultrasonic sensor trigger and echo, and the buzzer pin
+static inline void
+halSensorInit(void)
+{
+	DDRE |= (1 << HAL_TRIGGER_PIN) | (1 << HAL_BUZZER_PIN);
+	DDRE &= ~(1 << HAL_ECHO_PIN);
+}
+
+static inline void
+halTrigger(uint8_t level)
+{
+	if (level)
+	{
+		PORTE |= (1 << HAL_TRIGGER_PIN);
+	}
+	else
+	{
+		PORTE &= ~(1 << HAL_TRIGGER_PIN);
+	}
+}
+
+static inline uint8_t
+halEcho(void)
+{
+	return (PINE & (1 << HAL_ECHO_PIN)) != 0;
+}
+
+// Timer 4 in normal mode with a prescaler of 256, 16 us ticks
+static inline void
+halEchoTimerInit(void)
+{
+	TCCR4A = 0;
+	TCCR4B = (1 << CS42);
+}
+
+static inline void
+halEchoTimerReset(void)
+{
+	TCNT4 = 0;
+}
+
+// The echo ISR reads TCNT4 too, and both bytes of a 16 bit read go through
+// the shared TEMP register, so an edge between them would corrupt this one
+static inline uint16_t
+halEchoTimerRead(void)
+{
+	uint8_t sreg = halInterruptsSave();
+	uint16_t count = TCNT4;
+	halInterruptsRestore(sreg);
+	return count;
+}
+
+// Timer 1 counting CPU cycles. halCyclesOpen() takes the timer over and
+// returns its old mode for halCyclesClose().
+static inline uint16_t
+halCyclesOpen(void)
+{
+	uint16_t saved = ((uint16_t) TCCR1A << 8) | TCCR1B;
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+	return saved;
+}
+
+static inline void
+halCyclesClose(uint16_t saved)
+{
+	TCCR1A = (uint8_t) (saved >> 8);
+	TCCR1B = (uint8_t) saved;
+}
+
+// Start counting, interrupts have to be off
+static inline void
+halCyclesStart(void)
+{
+	TCNT1 = 0;
+	TIFR1 = (1 << TOV1);
+}
+
+// Get the cycles counted since halCyclesStart(), up to 131071
+static inline uint32_t
+halCyclesTaken(void)
+{
+	uint32_t cycles = TCNT1;
+	if (TIFR1 & (1 << TOV1))
+	{
+		cycles += 65536UL;
+	}
+	return cycles;
+}
+
+static inline uint8_t
+halEepromRead(uint16_t address)
+{
+	while (EECR & (1 << EEPE));
+	EEAR = address;
+	EECR |= (1 << EERE);
+	return EEDR;
+}
+
+static inline void
+halEepromWrite(uint16_t address, uint8_t data)
+{
+	while (EECR & (1 << EEPE));
+	EEAR = address;
+	EEDR = data;
+	// EEMPE has to be followed by EEPE within four cycles
+	uint8_t sreg = halInterruptsSave();
+	EECR |= (1 << EEMPE);
+	EECR |= (1 << EEPE);
+	halInterruptsRestore(sreg);
+}
+
+#else
+
+void halDelayUs(uint16_t us);
+void halInterruptsOn(void);
+uint8_t halInterruptsSave(void);
+void halInterruptsRestore(uint8_t sreg);
+void halLinkInit(uint16_t ubrr, uint8_t doubleSpeed);
+void halLinkSend(struct linkFrame *frame);
+uint8_t halLinkReadable(void);
+uint8_t halLinkRead(void);
+void halDebugInit(uint16_t ubrr, uint8_t doubleSpeed);
+uint8_t halDebugWritable(void);
+void halDebugWrite(uint8_t data);
+uint8_t halDebugReadable(void);
+uint8_t halDebugRead(void);
+void halSensorInit(void);
+void halTrigger(uint8_t level);
+uint8_t halEcho(void);
+void halEchoTimerInit(void);
+void halEchoTimerReset(void);
+uint16_t halEchoTimerRead(void);
+uint16_t halCyclesOpen(void);
+void halCyclesClose(uint16_t saved);
+void halCyclesStart(void);
+uint32_t halCyclesTaken(void);
+uint8_t halEepromRead(uint16_t address);
+void halEepromWrite(uint16_t address, uint8_t data);
+void KEYPAD_Init(void);
+uint8_t KEYPAD_GetKey(void);
+
+#endif
+
+#endif
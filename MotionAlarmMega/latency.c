@@ -0,0 +1,84 @@
+/*
+ * latency.c
+ *
+ * Worst interrupt latencies against their budgets.
+ */ 
+
+#include <stdio.h>
+#include "hal.h"
+#include "latency.h"
+
+volatile uint16_t latencyWorst[LATENCY_VECTORS];
+volatile uint16_t latencyHeld[LATENCY_VECTORS];
+
+static const char *vectorNames[LATENCY_VECTORS] = {
+	"echo", "siren", "clock", "link_rx", "link_tx"
+};
+
+static const uint16_t vectorBudgets[LATENCY_VECTORS] = {
+	LATENCY_BUDGET_ECHO, LATENCY_BUDGET_SIREN, LATENCY_BUDGET_CLOCK,
+	LATENCY_BUDGET_LINK_RX, LATENCY_BUDGET_LINK_TX
+};
+
+// 1 for the handlers without a timer, their latency is the bound
+static const uint8_t vectorBounded[LATENCY_VECTORS] = {
+	1, 0, 0, 1, 1
+};
+
+void
+latencyReset(void)
+{
+	uint8_t sreg = halInterruptsSave();
+	for (uint8_t i = 0; i < LATENCY_VECTORS; i++)
+	{
+		latencyWorst[i] = 0;
+		latencyHeld[i] = 0;
+	}
+	halInterruptsRestore(sreg);
+	return;
+}
+
+// Print the worst latency and the longest time interrupts were held off of
+// every vector in cycles. The latency of a handler without a timer is its
+// entry plus the longest hold of any other handler.
+void
+latencyReport(void (*print)(const char *text))
+{
+	uint16_t worst[LATENCY_VECTORS];
+	uint16_t held[LATENCY_VECTORS];
+	uint8_t sreg = halInterruptsSave();
+	for (uint8_t i = 0; i < LATENCY_VECTORS; i++)
+	{
+		worst[i] = latencyWorst[i];
+		held[i] = latencyHeld[i];
+	}
+	halInterruptsRestore(sreg);
+	
+	for (uint8_t i = 0; i < LATENCY_VECTORS; i++)
+	{
+		if (!vectorBounded[i])
+		{
+			continue;
+		}
+		uint16_t blocking = 0;
+		for (uint8_t j = 0; j < LATENCY_VECTORS; j++)
+		{
+			if (j != i && held[j] > blocking)
+			{
+				blocking = held[j];
+			}
+		}
+		worst[i] = LATENCY_ENTRY + blocking;
+	}
+	
+	char line[64];
+	print("isr      worst  held  budget\r\n");
+	for (uint8_t i = 0; i < LATENCY_VECTORS; i++)
+	{
+		snprintf(line, sizeof(line), "%-7s %6u %5u %7u%s\r\n", vectorNames[i],
+			worst[i], held[i], vectorBudgets[i],
+			worst[i] > vectorBudgets[i] ? " over" : "");
+		print(line);
+	}
+	return;
+}
@@ -0,0 +1,112 @@
+/*
+ * latency.h
+ *
+ * Interrupt policy and latency stamps. The AVR has no interrupt priority
+ * levels: a handler runs with interrupts off until it turns them back on,
+ * and whatever is pending then is taken in vector order. The priorities
+ * are therefore kept by how long each handler holds the others off:
+ *
+ *   1. INT5, echo capture (echo.c). Takes the timer 4 count before
+ *      anything else and never turns interrupts back on. An echo edge can
+ *      only be held off by the other handlers' time with interrupts off
+ *      and by the critical sections of the main code.
+ *   2. USART1_RX and USART1_UDRE, link (link.c). Move a byte each with
+ *      interrupts off, a received byte has to be read before the next two
+ *      arrive. At 500 kbaud that is the tightest deadline on the board
+ *      after the echo.
+ *   3. TIMER3_OVF, siren steps (siren.c). Short enough to run with
+ *      interrupts off.
+ *   4. TIMER5_COMPA, clock (clock.c). Counts the millisecond with
+ *      interrupts off, then masks its own source and turns interrupts back
+ *      on for the tick function, so the watchdog check can't hold off an
+ *      echo.
+ *
+ * A new handler that can take longer than the echo budget does the same
+ * as the clock. The main code keeps cli() sections to a few stores.
+ *
+ * The timer handlers stamp how many cycles after their interrupt was
+ * raised they got to their work and turned interrupts back on, from the
+ * count of their own timer. The other handlers have no count to stamp
+ * from, they time how long they held interrupts off on timer 5 and their
+ * latency is bounded by the longest time any other handler held them off
+ * plus their own entry. With LATENCY_GPIO the echo handler also pulses
+ * PB7 (pin 13) so the edge to capture time can be seen on a scope.
+ * tools/latency_report.py works the bounds out from the listing and checks
+ * them and the measured ones against the budgets.
+ */ 
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include "clock.h"
+
+#ifndef LATENCY_GPIO
+#define LATENCY_GPIO 0	// 1: pulse PB7 in the echo handler
+#endif
+
+// Vectors
+#define LATENCY_ECHO 0	// INT5, echo edge to timer 4 read
+#define LATENCY_SIREN 1	// TIMER3_OVF, overflow to the step count
+#define LATENCY_CLOCK 2	// TIMER5_COMPA, compare match to the millisecond count
+#define LATENCY_LINK_RX 3	// USART1_RX, byte received to UDR1 read
+#define LATENCY_LINK_TX 4	// USART1_UDRE, data register empty to the next byte written
+#define LATENCY_VECTORS 5
+
+// Budgets in CPU cycles, keep tools/latency_report.py in step
+#define LATENCY_BUDGET_ECHO 256	// One timer 4 tick, an echo is never timed a tick late
+#define LATENCY_BUDGET_SIREN 1024	// Well inside the 30 counts the stamp can tell apart
+#define LATENCY_BUDGET_CLOCK 4000	// A quarter of a millisecond, clockMicros() copes with half
+#define LATENCY_BUDGET_LINK_RX 320	// One byte at 500 kbaud, the second receive buffer is the margin
+#define LATENCY_BUDGET_LINK_TX 320	// One byte at 500 kbaud, while the shift register is still busy
+
+#define LATENCY_TICK 64	// Cycles per count of timers 3 and 5
+#define LATENCY_ENTRY 40	// Interrupt response, vector jump and prologue of a handler without a timer
+
+extern volatile uint16_t latencyWorst[LATENCY_VECTORS];
+extern volatile uint16_t latencyHeld[LATENCY_VECTORS];
+
+#ifdef __AVR__
+// Note the count of the vector's timer when its work is done. Only for
+// handlers, with interrupts still off.
+static inline void
+latencyStamp(uint8_t vector, uint8_t count)
+{
+	uint16_t cycles = (uint16_t) count * LATENCY_TICK;
+	if (cycles > latencyWorst[vector])
+	{
+		latencyWorst[vector] = cycles;
+	}
+}
+
+// Note the count of the vector's timer when interrupts are turned back on
+// or the handler returns
+static inline void
+latencyRelease(uint8_t vector, uint8_t count)
+{
+	uint16_t cycles = (uint16_t) count * LATENCY_TICK;
+	if (cycles > latencyHeld[vector])
+	{
+		latencyHeld[vector] = cycles;
+	}
+}
+
+// Note how long a handler without a timer of its own held interrupts off,
+// from the timer 5 count it read at its entry. Rounded up to a whole count.
+static inline void
+latencyHold(uint8_t vector, uint8_t start)
+{
+	uint8_t now = TCNT5L;
+	uint8_t counts = now >= start ? now - start : now + (CLOCK_TOP + 1) - start;
+	uint16_t cycles = (uint16_t) (counts + 1) * LATENCY_TICK;
+	if (cycles > latencyHeld[vector])
+	{
+		latencyHeld[vector] = cycles;
+	}
+}
+#endif
+
+void latencyReset(void);
+void latencyReport(void (*print)(const char *text));
+
+#endif
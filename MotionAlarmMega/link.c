@@ -0,0 +1,56 @@
+/*
+ * link.c
+ *
+ * USART1 interrupts of the link to the atmega328p.
+ */ 
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "latency.h"
+#include "link.h"
+#include "trace.h"
+
+struct linkQueue linkReceived;
+struct linkFrameQueue linkSending;
+struct linkFramePool linkFrames;
+
+static struct linkFrame *sendingFrame = 0;
+static uint8_t sendingNext = 0;
+
+// A few stores with interrupts off, see latency.h. A byte that finds the
+// queue full is dropped, as the hardware buffer would have done.
+ISR(USART1_RX_vect)
+{
+	uint8_t start = TCNT5L;
+	uint8_t data = UDR1;
+	linkQueuePush(&linkReceived, data);
+	latencyHold(LATENCY_LINK_RX, start);
+}
+
+// Send the next byte of the queued frames, a frame goes back to the pool
+// after its last byte. Turns itself off when there is nothing left,
+// halLinkSend() turns it back on.
+ISR(USART1_UDRE_vect)
+{
+	uint8_t start = TCNT5L;
+	if (!sendingFrame)
+	{
+		if (!linkFrameQueuePop(&linkSending, &sendingFrame))
+		{
+			UCSR1B &= ~(1 << UDRIE1);
+			latencyHold(LATENCY_LINK_TX, start);
+			return;
+		}
+		sendingNext = 0;
+	}
+	uint8_t data = sendingFrame->bytes[sendingNext];
+	UDR1 = data;
+	traceEvent(TRACE_TX, data);
+	sendingNext += 1;
+	if (sendingNext >= sendingFrame->length)
+	{
+		linkFramePoolFree(&linkFrames, sendingFrame);
+		sendingFrame = 0;
+	}
+	latencyHold(LATENCY_LINK_TX, start);
+}
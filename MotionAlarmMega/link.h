@@ -0,0 +1,42 @@
+/*
+ * link.h
+ *
+ * Queues of the link to the atmega328p. The USART1 receive interrupt
+ * pushes every byte, halLinkRead() pops them in the main loop, so bytes
+ * that arrive while the main loop is busy wait in RAM instead of
+ * overrunning the two byte hardware buffer.
+ *
+ * Everything going the other way, codes, telemetry and screen deltas, is
+ * written once into a block of linkFrames and passed by pointer:
+ * halLinkSend() queues the frame, the USART1 data register empty interrupt
+ * sends it a byte at a time and gives the block back. The main loop only
+ * waits when all blocks are in flight, and the order on the wire stays
+ * the order of the calls.
+ */ 
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+#include "../common/pool.h"
+#include "../common/spsc.h"
+
+#define LINK_QUEUE_SIZE 32	// Bytes, a power of two up to 256
+#define LINK_FRAMES 3	// Frames in flight at once
+#define LINK_FRAME_QUEUE 4	// Power of two above LINK_FRAMES, so a push never fails
+#define LINK_FRAME_SIZE 36	// Bytes, the longest screen delta is SCREEN_SIZE + 3
+
+struct linkFrame {
+	uint8_t length;
+	uint8_t bytes[LINK_FRAME_SIZE];
+};
+
+SPSC_QUEUE(linkQueue, uint8_t, LINK_QUEUE_SIZE)
+SPSC_QUEUE(linkFrameQueue, struct linkFrame *, LINK_FRAME_QUEUE)
+POOL(linkFramePool, struct linkFrame, LINK_FRAMES)
+
+extern struct linkQueue linkReceived;
+extern struct linkFrameQueue linkSending;
+extern struct linkFramePool linkFrames;
+
+#endif
@@ -5,25 +5,65 @@
  */ 
 
 #define F_CPU 16000000UL
-#define FOSC 16000000UL
-#define BAUD 115200
-#define MYUBRR (FOSC/16/BAUD-1)
+#define LINK_BAUD 500000	// Link baud rate, 250000 and 1000000 also divide exactly
+#define DEBUG_BAUD 115200	// Debug port baud rate
 
 #include <stdio.h>
-#include <avr/io.h>
-#include <util/delay.h>
-#include <avr/interrupt.h>
-#include "keypad/keypad.h"
-
-#define BUZZER_PIN PE3
-#define TRIGGER_PIN PE4
-#define ECHO_PIN PE5
+#include <string.h>
+#include "hal.h"
+#include "screen.h"
+#include "siren.h"
+#include "clock.h"
+#include "timer.h"
+#include "pin.h"
+#include "trace.h"
+#include "profile.h"
+#include "watchdog.h"
+#include "echo.h"
+#include "latency.h"
+#include "../common/baud.h"
+#include "../common/stack.h"
+
+#if BAUD_ERROR(LINK_BAUD) > BAUD_TOL
+#error "LINK_BAUD can't be generated accurately from F_CPU"
+#endif
+#if BAUD_ERROR(DEBUG_BAUD) > BAUD_TOL
+#error "DEBUG_BAUD can't be generated accurately from F_CPU"
+#endif
+
 #define TRIGGER_DIST 30	// Sensor trigger distance in cm
 #define ALARM_DELAY 10	// Time between motion detected and buzzer on in seconds
+#define FAST_CHIRP_DELAY 3	// Seconds left when the countdown chirp speeds up
 #define INPUTDELAY 400	// Minimum time between keypad inputs in ms
-#define EEPROM_ADDRESS 0	// Address in EEPROM where the password string starts
+#define ECHO_TIMEOUT 2500	// Maximum wait for an echo edge in timer 4 ticks (40 ms)
+#define TELEMETRY_INTERVAL 1000	// Minimum time between telemetry messages in ms
+#define TELEMETRY_HYSTERESIS 2	// Distance change in cm needed to resend telemetry
+#define REMOTE_DISPLAY 0	// 1: draw the LCD here and send only changed characters
+#define HEARTBEAT_INTERVAL 1000	// Time between heartbeats in ms
+#define HEARTBEAT_MISSED_LIMIT 3	// Missed heartbeats before the link is reset
+#define LINKSTATS_INTERVAL 5	// Heartbeats between link statistics reports
+#define RTT_BUCKETS 20	// Power of two latency histogram buckets, up to ~1 s
+#define ENTRY_TIMEOUT 10000	// Keypad inactivity in ms before a password entry is cancelled
+#define LOCKOUT_FREE 3	// Wrong codes in a row allowed before the keypad is locked
+#define LOCKOUT_BASE 5	// First lockout in seconds, doubled for every further wrong code
+#define LOCKOUT_MAX 230	// Longest lockout in seconds, at most TELEMETRY_MAX
+#define PIN_BENCHMARK 0	// 1: print the cycles taken to hash and verify the PIN at boot
+#define CONSOLE_LINE 16	// Longest debug console command
+#define STACK_CHECK_INTERVAL 1000	// Time between stack high-water mark scans in ms
 
 // System states and communication constants
+#define CONNECT 111
+#define MEMORY 235
+#define LOCKOUT 236
+#define PINREJECTED 237
+#define SLOTCLEARED 238
+#define SLOTINPUT 239
+#define ENTRYCANCEL 240
+#define COUNTDOWN 241
+#define SCREEN 242
+#define LINKSTATS 243
+#define HEARTBEAT 244
+#define TELEMETRY 245
 #define ARMED 246
 #define MOVEMENT 247
 #define DISARMED 248
@@ -35,150 +75,267 @@
 #define WRONGPASS 254
 #define TIMEOUT 255
 
+// Payload values are capped below the communication constants so a payload
+// byte can never be mistaken for a state change, nor for a heartbeat or a
+// memory request, which the atmega328p answers wherever they turn up
+#define TELEMETRY_MAX (MEMORY - 1)
+
+#if LOCKOUT_MAX > TELEMETRY_MAX
+#error "LOCKOUT_MAX is sent as a payload and must not exceed TELEMETRY_MAX"
+#endif
+
 volatile uint8_t state = 0;
-volatile uint8_t secondsElapsed = 0;
+Timer holdTimer;
+Timer redrawTimer;
+Timer keyTimer;
+
+// Password entry sub-state, runs next to the main state so ranging and the
+// entry delay keep going while the user types
+#define ENTRY_IDLE 0
+#define ENTRY_BUSY 1
+#define ENTRY_CORRECT 2
+#define ENTRY_WRONG 3
+#define ENTRY_SAVED 4
+#define ENTRY_CANCELLED 5
+
+// What the entry is asking for. Changing a code takes the master code, then
+// the slot number, then the new code.
+#define PROMPT_CHECK 0
+#define PROMPT_MASTER 1
+#define PROMPT_SLOT 2
+#define PROMPT_NEWPIN 3
+uint8_t entryPrompt = PROMPT_CHECK;
+uint8_t entrySlot = 0;
+uint8_t entryRunning = 0;
+uint8_t entryTimedOut = 0;
+uint8_t entryLength = 0;
+Timer entryTimer;
+
+// Keypad lockout after repeated wrong codes
+Timer lockoutTimer;
+Timer lockoutTickTimer;
+uint32_t lockoutEnds = 0;
+uint8_t lockoutShown = 0;
+
+// Entry delay and its countdown while in MOVEMENT
+Timer alarmTimer;
+Timer countdownTimer;
+uint8_t alarmTimedOut = 0;
+uint8_t countdownRemaining = 0;
+
+// Ranging statistics, the sample counter is latched once per second to get
+// the sample rate
+Timer telemetryTimer;
+Timer sampleTimer;
+uint8_t samplesCounted = 0;
+uint8_t samplesPerSecond = 0;
+uint8_t echoFaults = 0;
+uint8_t lastTelemetryDistance = 255;
+
+// Link health, round-trip times are measured in microseconds
+Timer heartbeatTimer;
+uint8_t linkConnected = 0;
+uint8_t heartbeatSequence = 0;
+uint8_t heartbeatPending = 0;
+uint8_t heartbeatsMissed = 0;
+uint8_t heartbeatReply = 0;
+uint8_t linkStatsDue = 0;
+uint32_t heartbeatSentAt = 0;
+uint16_t heartbeatsSent = 0;
+uint16_t heartbeatsLost = 0;
+uint16_t linkResets = 0;
+uint32_t rttMin = 0xFFFFFFFF;
+uint32_t rttMax = 0;
+uint16_t rttHistogram[RTT_BUCKETS];
+
+// Bytes of stack never used on both boards, the atmega328p reports its own
+// after every LINKSTATS_INTERVAL heartbeats
+Timer stackTimer;
+uint16_t stackFree = 0xFFFF;
+uint16_t remoteStackFree = 0xFFFF;
+uint8_t remoteStackLow = 0;
+uint8_t memoryReply = 0;
+
+// Debug console command being typed
+char consoleLine[CONSOLE_LINE];
+uint8_t consoleLength = 0;
+
+void 
+initSerial()
+{
+	halLinkInit(BAUD_UBRR(LINK_BAUD), BAUD_USE_2X(LINK_BAUD));
+	return;
+}
 
-// Save password to eeprom from the string given as parameter
+// Initialize USART0 (the USB serial port) for debug output and the debug
+// console
 void
-savePassword(char password[4]) {
-	// Loop four times to save each character of the password
-	for (uint8_t i = 0; i < 4; i++) {
-		while (EECR & (1 << EEPE));
-		EEAR = EEPROM_ADDRESS + i;
-		EEDR = password[i];
-		EECR |= (1 << EEMPE);
-		EECR |= (1 << EEPE);
-	}
+initDebug()
+{
+	halDebugInit(BAUD_UBRR(DEBUG_BAUD), BAUD_USE_2X(DEBUG_BAUD));
 	return;
 }
 
-// Load password from eeprom to the string given as parameter
+// Write a string to the debug port
 void
-loadPassword(char password[4]) {
-	// Loop four times to get each character of the password
-	for (uint8_t i = 0; i < 4; i++) {
-		while (EECR & (1 << EEPE));
-		EEAR = EEPROM_ADDRESS + i;
-		EECR |= (1 << EERE);
-		password[i] = EEDR;
+debugPrint(const char *text)
+{
+	traceFlush();
+	while (*text)
+	{
+		while (!halDebugWritable()) {}
+		halDebugWrite(*text++);
 	}
 	return;
 }
 
-void 
-initSerial()
+// Latch the number of distance samples taken in the last second
+void
+latchSampleRate()
 {
-	// Set baud rate in the USART Baud Rate Registers
-	UBRR1H = (uint8_t) (MYUBRR >> 8);
-	UBRR1L = (uint8_t) MYUBRR;
-	
-	// Enable transmitter and receiver
-	UCSR1B = (1 << TXEN1) | (1 << RXEN1);
-	
-	// Set frame format: 8 data bits, 1 stop bit, no parity
-    UCSR1C = (1 << UCSZ11) | (1 << UCSZ10);
+	samplesPerSecond = samplesCounted;
+	samplesCounted = 0;
+	timerStart(&sampleTimer, 1000, latchSampleRate);
+	return;
+}
+
+// Update the stack high-water mark. Only the bytes still unused at the
+// last scan are looked at again.
+void
+stackCheck()
+{
+	stackFree = stackUnused(stackFree);
+	timerStart(&stackTimer, STACK_CHECK_INTERVAL, stackCheck);
 	return;
 }
 
 void 
 initTimers() 
 {		
-	// Set timers 4 and 5 to normal mode
-	TCCR4A = 0;
-	TCCR4B = 0;
-	TCCR5A = 0;
-	TCCR5B = 0;
-	
-	// Set timer prescalers to 256
-	TCCR4B |= (1 << CS42);
-	TCCR5B |= (1 << CS52);
+	// Set timer 4 to normal mode with a prescaler of 256 for echo timing,
+	// the echo edges are captured on it by INT5
+	halEchoTimerInit();
+	echoInit();
 	
-	// Set timer 5 compare interrupt to trigger exactly every 1 second
-	OCR5A = 62500;
-	TIMSK5 |= (1 << OCIE5A);
+	// Start the millisecond system clock on timer 5, with the watchdog
+	// checked on every tick, and the software timers running on it
+	clockInit(watchdogTick);
+	timerInit();
+	timerStart(&sampleTimer, 1000, latchSampleRate);
+	stackCheck();
 	return;
 }
 
-// Timer 5 ISR for the 10 second timeout
-ISR(TIMER5_COMPA_vect) {
-	secondsElapsed++;
+// Get a block for a frame to the atmega328p, waiting for one of the frames
+// in flight to go out if all are taken. Only the main loop takes blocks, so
+// the allocation can't fail after the wait and failed stays a real count.
+struct linkFrame *
+frameAlloc(void)
+{
+	while (linkFramePoolLeft(&linkFrames) == 0) {}
+	return linkFramePoolAlloc(&linkFrames);
 }
 
+// Send a message to the atmega328p controlling the LCD as one frame. It
+// goes out from the transmit interrupt while the main loop carries on.
 void
-enableBuzzer() {
-	// Set timer 3 to fast PWM with ICR as TOP and a prescaler of 256
-	TCCR3A |= (1 << COM3A1) | (1 << WGM31);
-	TCCR3B |= (1 << WGM32) | (1 << WGM33) | (1 << CS32);
-		
-	// Set ICR3 based on desired frequency
-	// ICR3 should be (16000000/256)/frequency
-	ICR3 = 125;
+sendBytes(const uint8_t *bytes, uint8_t length)
+{
+	struct linkFrame *frame = frameAlloc();
+	memcpy(frame->bytes, bytes, length);
+	frame->length = length;
+	halLinkSend(frame);
 	return;
 }
 
-void
-disableBuzzer() {
-	// Reset all timer 3 registers to stop the buzzer
-	TCCR3A = 0;
-	TCCR3B = 0;
-	ICR3 = 0;
+// Send a single code to the atmega328p
+void 
+sendData(uint8_t data)
+{
+	sendBytes(&data, 1);
 	return;
 }
 
-// Receive a byte from the atmega358p controlling the LCD, waiting for the
-// message as many milliseconds as the parameter "timeout" determines
-unsigned char
-receiveData(uint16_t timeout) {
-	uint16_t timeElapsed = 0;
-	while (!(UCSR1A & (1 << RXC1)))
+// Send the screen delta, if any, as a frame
+void
+sendScreen(void)
+{
+	struct linkFrame *frame = frameAlloc();
+	if (screenFlush(SCREEN, frame))
 	{
-		timeElapsed += 1;
-		_delay_ms(1);
-		if (timeElapsed > timeout)
-		{
-			return TIMEOUT;
-		}
+		halLinkSend(frame);
+	}
+	else
+	{
+		linkFramePoolFree(&linkFrames, frame);
 	}
-	return UDR1;
+	return;
 }
 
-// Send a byte to the atmega358p controlling the LCD
-void 
-sendData(uint8_t data)
+// Wait until the echo ISR has taken the edge that reaches the given state,
+// returning 0 if the sensor does not respond within ECHO_TIMEOUT timer 4
+// ticks of the given count
+uint8_t
+waitForEcho(uint8_t captured, uint16_t since)
 {
-	// Wait for empty transmit buffer
-	while (!(UCSR1A & (1 << UDRE1))) {}
-	// Send the data
-	UDR1 = data;
-	return;
+	while (echoState() < captured)
+	{
+		if ((uint16_t) (halEchoTimerRead() - since) > ECHO_TIMEOUT)
+		{
+			// Traced as the level that was waited for
+			traceEvent(TRACE_ECHO_LOST, captured == ECHO_HIGH);
+			return 0;
+		}
+	}
+	return 1;
 }
 
 // Get the motion sensor's measured distance in centimeters
 uint8_t
 getDistance()
 {
+	uint8_t profiled = profileEnter(PROFILE_RANGING);
+	watchdogBegin(WATCHDOG_RANGING);
 	uint16_t tempDistance = 0;
+	uint8_t readings = 0;
 	// Get the average of 5 readings to make them more reliable
 	for (uint8_t i = 0; i < 5; i++) {
 		// Give a 15 microsecond pulse to trigger pin
-		PORTE &= ~(1 << TRIGGER_PIN);
-		_delay_us(2);
-		PORTE |= (1 << TRIGGER_PIN);
-		_delay_us(15);
-		PORTE &= ~(1 << TRIGGER_PIN);
+		echoArm();
+		halTrigger(0);
+		halDelayUs(2);
+		halTrigger(1);
+		halDelayUs(15);
+		halTrigger(0);
 		
-		// Wait until the echo pin goes high
-		while (!(PINE & (1 << ECHO_PIN))) {}
-		// Start measuring time
-		TCNT4 = 0;
-		// Wait until output pulse goes low
-		while ((PINE & (1 << ECHO_PIN))) {}
+		// Wait for the ISR to time the echo from its rising to its falling
+		// edge. A missing edge is counted as a fault and the reading skipped.
+		if (!waitForEcho(ECHO_HIGH, 0) || !waitForEcho(ECHO_DONE, echoRise()))
+		{
+			if (echoFaults < TELEMETRY_MAX)
+			{
+				echoFaults += 1;
+			}
+			continue;
+		}
+		uint16_t width = echoWidth();
+		traceEvent(TRACE_ECHO, width);
 			
 		// Calculate the distance, the multiplier 0.2755392 is 0.016 (ms per
 		// timer tick) * 17.2212 (how many cm speed travels in a ms)
-		tempDistance += TCNT4*0.2755392;
+		tempDistance += width*0.2755392;
+		readings += 1;
+	}
+	samplesCounted += 1;
+	
+	// Report maximum distance if the sensor didn't respond at all
+	if (readings == 0)
+	{
+		watchdogEnd(WATCHDOG_RANGING);
+		profileEnter(profiled);
+		return 255;
 	}
-	tempDistance /= 5;
+	tempDistance /= readings;
 
 	// Make sure the 16 bit integer doesnt overflow the 8 bit one
 	if (tempDistance > 255)
@@ -186,194 +343,971 @@ getDistance()
 		tempDistance = 255;
 	}
 	uint8_t finalDistance = tempDistance;
+	watchdogEnd(WATCHDOG_RANGING);
+	profileEnter(profiled);
 	return finalDistance;
 }
 
-// Try to connect to the atmega358p
-uint8_t 
-attemptConnection() {
-	uint8_t attempts = 0;
-	// Attempt to receive connection message 111 until attempt count runs out
-	while (attempts < 50)
+// Send the latest ranging data to the atmega328p. Messages are sent at most
+// once per TELEMETRY_INTERVAL and only when the distance has changed by at
+// least TELEMETRY_HYSTERESIS, so the link is never saturated.
+void
+sendTelemetry(uint8_t distance)
+{
+	if (distance > TELEMETRY_MAX)
+	{
+		distance = TELEMETRY_MAX;
+	}
+	uint8_t change = distance > lastTelemetryDistance ?
+		distance - lastTelemetryDistance : lastTelemetryDistance - distance;
+	if (timerActive(&telemetryTimer) || change < TELEMETRY_HYSTERESIS)
+	{
+		return;
+	}
+	timerStart(&telemetryTimer, TELEMETRY_INTERVAL, 0);
+	lastTelemetryDistance = distance;
+	
+	uint8_t rate = samplesPerSecond;
+	if (rate > TELEMETRY_MAX)
+	{
+		rate = TELEMETRY_MAX;
+	}
+#if REMOTE_DISPLAY
+	char line[SCREEN_COLUMNS + 1];
+	snprintf(line, sizeof(line), "%3ucm %2u/s F%3u", distance,
+		rate > 99 ? 99 : rate, echoFaults);
+	screenPrint(0, 1, line);
+	sendScreen();
+#else
+	uint8_t message[] = {TELEMETRY, distance, rate, echoFaults};
+	sendBytes(message, sizeof(message));
+#endif
+	return;
+}
+
+// Show a state or a result on the LCD. Normally the code is sent as is and
+// the atmega328p picks the text. In remote display mode the screen is drawn
+// here and only the changed characters are sent.
+void
+display(uint8_t code)
+{
+	lockoutShown = 0;
+#if REMOTE_DISPLAY
+	screenClear();
+	switch (code)
+	{
+		case ARMED:
+			screenPrint(0, 0, "Alarm armed");
+			break;
+		case MOVEMENT:
+			screenPrint(0, 0, "Motion detected");
+			break;
+		case DISARMED:
+			screenPrint(0, 0, "Alarm disarmed");
+			break;
+		case INPUT:
+			screenPrint(0, 0, "Input password:");
+			break;
+		case SETPASSWORD:
+			screenPrint(0, 0, "Password set");
+			break;
+		case CORRECTPASS:
+			screenPrint(0, 0, "Correct password");
+			break;
+		case ALARMTIMEOUT:
+			screenPrint(0, 0, "Alarm timeout");
+			break;
+		case WRONGPASS:
+			screenPrint(0, 0, "Wrong password");
+			break;
+		case ENTRYCANCEL:
+			screenPrint(0, 0, "Entry cancelled");
+			break;
+		case SLOTINPUT:
+			screenPrint(0, 0, "Slot number:");
+			break;
+		case SLOTCLEARED:
+			screenPrint(0, 0, "Code removed");
+			break;
+		case PINREJECTED:
+			screenPrint(0, 0, "Code rejected");
+			break;
+	}
+	sendScreen();
+#else
+	sendData(code);
+#endif
+	return;
+}
+
+// Show a password keypad input on the LCD. Position is the index of the digit
+// that was added or erased.
+void
+displayInput(char input, uint8_t position)
+{
+#if REMOTE_DISPLAY
+	if (input != '#')
 	{
-		uint8_t message = receiveData(200);
-		if (message == 111)
+		screenPutc(position, 1, input == '*' ? ' ' : input);
+		sendScreen();
+	}
+#else
+	sendData(input);
+#endif
+	return;
+}
+
+// Show the seconds left before the alarm goes off in the bottom right
+// corner of the LCD
+void
+displayCountdown(uint8_t seconds)
+{
+#if REMOTE_DISPLAY
+	char text[4];
+	snprintf(text, sizeof(text), "%2us", seconds);
+	screenPrint(SCREEN_COLUMNS - 3, 1, text);
+	sendScreen();
+#else
+	uint8_t message[] = {COUNTDOWN, seconds};
+	sendBytes(message, sizeof(message));
+#endif
+	return;
+}
+
+// Count the entry delay down once per second and speed up the chirp at the
+// end. The last second is left to alarmExpired().
+void
+countdownTick()
+{
+	if (countdownRemaining > 1)
+	{
+		countdownRemaining -= 1;
+		displayCountdown(countdownRemaining);
+		if (countdownRemaining == FAST_CHIRP_DELAY)
 		{
-			// Send a message back to confirm the connection
-			sendData(111);
-			return 1;
+			sirenStart(SIREN_CHIRP_FAST);
+		}
+		timerStart(&countdownTimer, 1000, countdownTick);
+	}
+	return;
+}
+
+// The entry delay ran out without the correct password
+void
+alarmExpired()
+{
+	alarmTimedOut = 1;
+	timerCancel(&countdownTimer);
+	return;
+}
+
+// Get the upper bound of a latency percentile from the histogram in
+// microseconds, the result is accurate to the power of two bucket it falls in
+uint32_t
+rttPercentile(uint8_t percent)
+{
+	uint32_t total = 0;
+	for (uint8_t i = 0; i < RTT_BUCKETS; i++)
+	{
+		total += rttHistogram[i];
+	}
+	
+	uint32_t count = 0;
+	for (uint8_t i = 0; i < RTT_BUCKETS; i++)
+	{
+		count += rttHistogram[i];
+		if (total > 0 && count * 100 >= total * percent)
+		{
+			return (2UL << i) - 1;
 		}
-		attempts += 1;
 	}
 	return 0;
 }
 
-// Overwrite the password string given as parameter
+// Record a heartbeat round-trip time in the statistics
+void
+recordRoundTrip(uint32_t micros)
+{
+	traceEvent(TRACE_RTT, micros / 16 > 0xFFFF ? 0xFFFF : micros / 16);
+	uint8_t bucket = 0;
+	while (bucket < RTT_BUCKETS - 1 && (micros >> (bucket + 1)) > 0)
+	{
+		bucket += 1;
+	}
+	rttHistogram[bucket] += 1;
+	if (micros < rttMin)
+	{
+		rttMin = micros;
+	}
+	if (micros > rttMax)
+	{
+		rttMax = micros;
+	}
+	return;
+}
+
+// Print the link statistics to the debug port
+void
+printLinkStats()
+{
+	char line[96];
+	snprintf(line, sizeof(line),
+		"link %s rtt min %lu p50 %lu p95 %lu max %lu us, lost %u/%u, resets %u\r\n",
+		linkConnected ? "up" : "down",
+		rttMin == 0xFFFFFFFF ? 0 : rttMin, rttPercentile(50),
+		rttPercentile(95), rttMax,
+		heartbeatsLost, heartbeatsSent, linkResets);
+	debugPrint(line);
+	return;
+}
+
+// Send the median and 95th percentile round-trip times in 0.1 ms and the
+// heartbeat loss percentage to the atmega328p
 void
-setPassword(char password[4])
+sendLinkStats()
 {
-	// Signal beginning of password
-	sendData(INPUT);
-	uint8_t inputsGiven = 0;
+	uint32_t stats[3];
+	stats[0] = rttPercentile(50) / 100;
+	stats[1] = rttPercentile(95) / 100;
+	stats[2] = heartbeatsSent ? heartbeatsLost * 100UL / heartbeatsSent : 0;
 	
-	// Get four inputs, adding them to the password string as well as sending
-	// them to the LCD
-	while (1)
+	// LINKSTATS and the values
+	uint8_t message[4] = {LINKSTATS};
+	uint8_t *values = message + 1;
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		values[i] = stats[i] > TELEMETRY_MAX ? TELEMETRY_MAX : stats[i];
+	}
+	
+#if REMOTE_DISPLAY
+	char line[SCREEN_COLUMNS + 1];
+	snprintf(line, sizeof(line), "%2u.%u/%2u.%ums L%2u%%",
+		values[0] / 10, values[0] % 10, values[1] / 10, values[1] % 10,
+		values[2] > 99 ? 99 : values[2]);
+	screenPrint(0, 1, line);
+	sendScreen();
+#else
+	sendBytes(message, sizeof(message));
+#endif
+	linkStatsDue = 0;
+	return;
+}
+
+// Send a heartbeat every HEARTBEAT_INTERVAL while the link is up and drop
+// the link after HEARTBEAT_MISSED_LIMIT missed beats, after which the
+// atmega328p redoes the handshake
+void
+sendHeartbeat()
+{
+	// The previous heartbeat is lost if it hasn't been answered by now
+	if (heartbeatPending)
+	{
+		heartbeatsLost += 1;
+		heartbeatsMissed += 1;
+		if (heartbeatsMissed >= HEARTBEAT_MISSED_LIMIT)
+		{
+			linkConnected = 0;
+			heartbeatPending = 0;
+			linkResets += 1;
+			debugPrint("link down, waiting for handshake\r\n");
+			return;
+		}
+	}
+	
+	// Sequence numbers stay below 128 so they are never mistaken for a code
+	heartbeatSequence = (heartbeatSequence + 1) & 0x7F;
+	heartbeatSentAt = clockMicros();
+	heartbeatPending = 1;
+	heartbeatsSent += 1;
+	uint8_t message[] = {HEARTBEAT, heartbeatSequence};
+	sendBytes(message, sizeof(message));
+	
+	if (heartbeatsSent % LINKSTATS_INTERVAL == 0)
 	{
-		char input = KEYPAD_GetKey();
-		// Check if input is a character between 0-9
-		if (input > 47 && input < 58 && inputsGiven < 4)
+		printLinkStats();
+		linkStatsDue = 1;
+		sendData(MEMORY);
+	}
+	timerStart(&heartbeatTimer, HEARTBEAT_INTERVAL, sendHeartbeat);
+	return;
+}
+
+// Handle bytes from the atmega328p. Answers its connection handshake
+// whenever it arrives, so booting never waits for the LCD, and matches the
+// echoed heartbeats to measure the round-trip time.
+void
+serviceLink()
+{
+	while (halLinkReadable())
+	{
+		uint8_t message = halLinkRead();
+		traceEvent(TRACE_RX, message);
+		if (memoryReply)
 		{
-			password[inputsGiven] = input;
-			inputsGiven += 1;
-			sendData(input);
-			_delay_ms(INPUTDELAY);
+			// Unused stack of the atmega328p in two 7 bit halves, low first
+			memoryReply -= 1;
+			if (memoryReply)
+			{
+				remoteStackLow = message & 0x7F;
+			}
+			else
+			{
+				remoteStackFree = remoteStackLow | ((uint16_t) (message & 0x7F) << 7);
+			}
 		}
-		else if (input == '#' && inputsGiven == 4)
+		else if (heartbeatReply)
 		{
-			sendData('#');
-			break;
+			heartbeatReply = 0;
+			if (heartbeatPending && message == heartbeatSequence)
+			{
+				recordRoundTrip(clockMicros() - heartbeatSentAt);
+				heartbeatPending = 0;
+				heartbeatsMissed = 0;
+			}
 		}
-		else if (input == '*' && inputsGiven > 0)
+		else if (message == HEARTBEAT)
 		{
-			inputsGiven -= 1;
-			sendData('*');
-			_delay_ms(INPUTDELAY);
+			heartbeatReply = 1;
 		}
-		else
+		else if (message == MEMORY)
 		{
-			// Ignore other inputs
+			memoryReply = 2;
+		}
+		else if (message == CONNECT)
+		{
+			// The atmega328p (re)connected, confirm and resend the current
+			// state or screen so the LCD shows the right thing
+			sendData(CONNECT);
+			if (!linkConnected)
+			{
+				linkConnected = 1;
+				timerStart(&heartbeatTimer, HEARTBEAT_INTERVAL, sendHeartbeat);
+				char line[32];
+				snprintf(line, sizeof(line), "link up at %lu ms\r\n", clockMillis());
+				debugPrint(line);
+			}
+			heartbeatPending = 0;
+			heartbeatsMissed = 0;
+#if REMOTE_DISPLAY
+			screenInvalidate();
+			sendScreen();
+#else
+			if (state == ARMED || state == MOVEMENT || state == DISARMED)
+			{
+				sendData(state);
+				lastTelemetryDistance = 255;
+			}
+#endif
 		}
 	}
-	
-	// Save the password and inform the LCD we just set it
-	savePassword(password);
-	sendData(SETPASSWORD);
-	_delay_ms(1000);
 	return;
 }
 
-// Have user input password and check if it is correct. First parameter is
-// the correct password saved in the system and the second is a flag that
-// shows whether the 10 second timer is running.
-uint8_t 
-checkPassword(char password[4], uint8_t timeoutEnabled)
+// Print the RAM use of both boards to the debug port
+void
+printMemory()
 {
-	// Signal start of writing password
-	sendData(INPUT);
-	char inputPassword[4];
-	uint8_t inputsGiven = 0;
-	uint8_t passwordIsCorrect = 1;
-	
-	// Loop until user presses # after giving 4 inputs
-	while (1)
+	char line[80];
+	stackFree = stackUnused(stackFree);
+	snprintf(line, sizeof(line),
+		"mega ram static %u, stack peak %u of %u, %u never used\r\n",
+		stackStatic(), stackSize() - stackFree, stackSize(), stackFree);
+	debugPrint(line);
+	if (remoteStackFree == 0xFFFF)
 	{
-		char input = KEYPAD_GetKey();
-		// If timeout is enabled and time goes over 10 seconds, inform the LCD
-		if (timeoutEnabled && secondsElapsed > ALARM_DELAY) 
-		{
-			sendData('#');
-			sendData(ALARMTIMEOUT);
-			_delay_ms(1000);
-			return 0;
-		}
-		// Check if input is a character between 0-9, inform the LCD and add it to
-		// to the password string
-		else if (input > 47 && input < 58 && inputsGiven < 4)
+		debugPrint("uno stack not reported yet\r\n");
+	}
+	else
+	{
+		snprintf(line, sizeof(line), "uno stack %u never used\r\n",
+			remoteStackFree);
+		debugPrint(line);
+	}
+	snprintf(line, sizeof(line),
+		"link frames %u of %u in use, peak %u, %u allocations failed\r\n",
+		linkFrames.used, LINK_FRAMES, linkFrames.peak, linkFrames.failed);
+	debugPrint(line);
+	return;
+}
+
+// Run a debug console command
+void
+consoleCommand(const char *command)
+{
+	if (strcmp(command, "stats") == 0)
+	{
+		profileReport(debugPrint);
+	}
+	else if (strcmp(command, "reset") == 0)
+	{
+		profileReset();
+		latencyReset();
+		debugPrint("profile reset\r\n");
+	}
+	else if (strcmp(command, "isr") == 0)
+	{
+		latencyReport(debugPrint);
+	}
+	else if (strcmp(command, "link") == 0)
+	{
+		printLinkStats();
+	}
+	else if (strcmp(command, "mem") == 0)
+	{
+		printMemory();
+	}
+	else if (command[0] != '\0')
+	{
+		debugPrint("commands: stats, reset, link, mem, isr\r\n");
+	}
+	return;
+}
+
+// Collect debug console commands from USART0 without blocking, a command
+// runs when its line ends
+void
+serviceConsole()
+{
+	while (halDebugReadable())
+	{
+		char received = halDebugRead();
+		if (received == '\r' || received == '\n')
 		{
-			inputPassword[inputsGiven] = input;
-			inputsGiven += 1;
-			sendData(input);
-			_delay_ms(INPUTDELAY);
+			consoleLine[consoleLength] = '\0';
+			consoleLength = 0;
+			consoleCommand(consoleLine);
 		}
-		// If # is pressed, inform the LCD and break the input loop
-		else if (input == '#' && inputsGiven == 4)
+		else if (consoleLength < CONSOLE_LINE - 1)
 		{
-			sendData('#');
-			break;
+			consoleLine[consoleLength++] = received;
 		}
-		// If * is pressed, inform the LCD and go back one index
-		else if (input == '*' && inputsGiven > 0)
+	}
+	return;
+}
+
+// Keep the link, the software timers and the debug port running. Must be
+// called regularly from every polling loop.
+void
+service()
+{
+	uint8_t profiled = profileEnter(PROFILE_LINK);
+	watchdogBegin(WATCHDOG_LINK);
+	serviceLink();
+	watchdogEnd(WATCHDOG_LINK);
+	profileEnter(PROFILE_TIMERS);
+	watchdogBegin(WATCHDOG_TIMERS);
+	timerService();
+	watchdogEnd(WATCHDOG_TIMERS);
+	profileEnter(PROFILE_DEBUG);
+	traceService();
+	serviceConsole();
+	profileEnter(profiled);
+	return;
+}
+
+// Wait for the given number of milliseconds, keeping the link serviced
+void
+waitMs(uint16_t ms)
+{
+	uint8_t profiled = profileEnter(PROFILE_WAIT);
+	timerStart(&holdTimer, ms, 0);
+	while (timerActive(&holdTimer))
+	{
+		service();
+	}
+	profileEnter(profiled);
+	return;
+}
+
+// Scan the keypad, returning the key held down or 'z' if there is none.
+// Changes are traced, they are the keypad input of a recording.
+char
+scanKey()
+{
+	static char lastScanned = 'z';
+	uint8_t profiled = profileEnter(PROFILE_KEYPAD);
+	watchdogBegin(WATCHDOG_KEYPAD);
+	char key = KEYPAD_GetKey();
+	watchdogEnd(WATCHDOG_KEYPAD);
+	profileEnter(profiled);
+	if (key != lastScanned)
+	{
+		lastScanned = key;
+		traceEvent(TRACE_KEYSCAN, key);
+	}
+	return key;
+}
+
+// Read the keypad without blocking. A key that was taken is ignored for
+// INPUTDELAY so holding it down doesn't repeat it at loop speed. When
+// recording, the keypad is scanned during the hold too so releases and
+// short presses aren't missed.
+char
+readKey()
+{
+#if TRACE_RECORD
+	char key = scanKey();
+	if (timerActive(&keyTimer))
+	{
+		return 0;
+	}
+#else
+	if (timerActive(&keyTimer))
+	{
+		return 0;
+	}
+	char key = scanKey();
+#endif
+	if (key == 'z')
+	{
+		return 0;
+	}
+	timerStart(&keyTimer, INPUTDELAY, 0);
+	traceEvent(TRACE_KEY, key);
+	return key;
+}
+
+// Ignore the keypad for INPUTDELAY, used when entering a state so the key
+// that led there isn't taken again
+void
+holdKeys()
+{
+	timerStart(&keyTimer, INPUTDELAY, 0);
+	return;
+}
+
+// Show the current state again after a message has been on the LCD for a
+// while, unless a new password entry has started by then
+void
+redrawState()
+{
+	if (entryRunning)
+	{
+		return;
+	}
+	if (state == ARMED || state == MOVEMENT || state == DISARMED)
+	{
+		display(state);
+		lastTelemetryDistance = 255;
+	}
+	if (state == MOVEMENT)
+	{
+		displayCountdown(countdownRemaining);
+	}
+	return;
+}
+
+// Show that the keypad is locked and the seconds left, leaving the bottom
+// right corner free for the countdown
+void
+displayLockout()
+{
+	uint8_t seconds = 0;
+	if (timerActive(&lockoutTimer))
+	{
+		seconds = (lockoutEnds - clockMillis() + 999) / 1000;
+	}
+#if REMOTE_DISPLAY
+	if (!lockoutShown)
+	{
+		screenClear();
+		screenPrint(0, 0, "Keypad locked");
+	}
+	char line[SCREEN_COLUMNS + 1];
+	snprintf(line, sizeof(line), "Retry in %3us", seconds);
+	screenPrint(0, 1, line);
+	sendScreen();
+#else
+	uint8_t message[] = {LOCKOUT, seconds};
+	sendBytes(message, sizeof(message));
+#endif
+	lockoutShown = 1;
+	return;
+}
+
+// Update the seconds left once per second while the lockout is shown
+void
+lockoutTick()
+{
+	if (lockoutShown)
+	{
+		displayLockout();
+	}
+	timerStart(&lockoutTickTimer, 1000, lockoutTick);
+	return;
+}
+
+// The lockout is over, put the state back on the LCD if it was covered
+void
+lockoutEnd()
+{
+	timerCancel(&lockoutTickTimer);
+	if (lockoutShown)
+	{
+		lockoutShown = 0;
+		redrawState();
+	}
+	debugPrint("keypad unlocked\r\n");
+	return;
+}
+
+// Lock the keypad if there have been too many wrong codes in a row. The
+// lockout doubles with every further wrong code up to LOCKOUT_MAX. The count
+// is kept in EEPROM, so a reset starts the lockout over instead of ending
+// it.
+void
+lockoutStart()
+{
+	uint8_t failures = pinFailures();
+	if (failures < LOCKOUT_FREE)
+	{
+		return;
+	}
+	uint16_t seconds = LOCKOUT_MAX;
+	if (failures - LOCKOUT_FREE < 6)
+	{
+		seconds = LOCKOUT_BASE << (failures - LOCKOUT_FREE);
+	}
+	if (seconds > LOCKOUT_MAX)
+	{
+		seconds = LOCKOUT_MAX;
+	}
+	lockoutEnds = clockMillis() + seconds * 1000UL;
+	timerStart(&lockoutTimer, seconds * 1000UL, lockoutEnd);
+	timerStart(&lockoutTickTimer, 1000, lockoutTick);
+	
+	char line[48];
+	snprintf(line, sizeof(line), "keypad locked for %u s after %u wrong codes\r\n",
+		seconds, failures);
+	debugPrint(line);
+	return;
+}
+
+// Check if the keypad is locked
+uint8_t
+lockedOut()
+{
+	return timerActive(&lockoutTimer);
+}
+
+// The user stopped typing for ENTRY_TIMEOUT
+void
+entryExpired()
+{
+	entryTimedOut = 1;
+	return;
+}
+
+// Start a password entry for the given prompt. Keys are then passed to
+// entryUpdate() from the state loop. While the keypad is locked the lockout
+// is shown instead and no entry starts.
+void
+entryStart(uint8_t prompt)
+{
+	timerCancel(&redrawTimer);
+	if (lockedOut() && (prompt == PROMPT_CHECK || prompt == PROMPT_MASTER))
+	{
+		displayLockout();
+		return;
+	}
+	display(prompt == PROMPT_SLOT ? SLOTINPUT : INPUT);
+	if (state == MOVEMENT)
+	{
+		// The input screen replaces the countdown so have it redrawn
+		displayCountdown(countdownRemaining);
+	}
+	if (prompt != PROMPT_SLOT)
+	{
+		pinBegin();
+	}
+	entryPrompt = prompt;
+	entryLength = 0;
+	entryTimedOut = 0;
+	entryRunning = 1;
+	timerStart(&entryTimer, ENTRY_TIMEOUT, entryExpired);
+	return;
+}
+
+// Start changing a code. Only the master code can do that, unless no code
+// has been set yet in which case the master code is set right away.
+void
+entryStartChange()
+{
+	if (pinSlotUsed(PIN_MASTER))
+	{
+		entryStart(PROMPT_MASTER);
+	}
+	else
+	{
+		entrySlot = PIN_MASTER;
+		entryStart(PROMPT_NEWPIN);
+	}
+	return;
+}
+
+// Finish an entry after '#', going on to the next prompt when changing a
+// code. Shows the outcome on the LCD and returns the result.
+uint8_t
+entryFinish()
+{
+	uint8_t slot;
+	switch (entryPrompt)
+	{
+		case PROMPT_CHECK:
+			slot = pinFind();
+			if (slot == PIN_NONE)
+			{
+				display(WRONGPASS);
+				pinFailed();
+				lockoutStart();
+				return ENTRY_WRONG;
+			}
+			pinPassed();
+			if (slot >= PIN_DURESS_FIRST)
+			{
+				// Disarm as usual so nothing shows, only the debug port
+				// knows
+				char line[32];
+				snprintf(line, sizeof(line), "duress code %u used\r\n", slot);
+				debugPrint(line);
+			}
+			display(CORRECTPASS);
+			return ENTRY_CORRECT;
+		
+		case PROMPT_MASTER:
+			if (pinFind() != PIN_MASTER)
+			{
+				display(WRONGPASS);
+				pinFailed();
+				lockoutStart();
+				return ENTRY_WRONG;
+			}
+			pinPassed();
+			entrySlot = 0;
+			entryStart(PROMPT_SLOT);
+			return ENTRY_BUSY;
+		
+		case PROMPT_SLOT:
+			if (entrySlot >= PIN_SLOTS)
+			{
+				display(PINREJECTED);
+				return ENTRY_WRONG;
+			}
+			entryStart(PROMPT_NEWPIN);
+			return ENTRY_BUSY;
+		
+		default:
+			// No digits removes the code, except the master code. Codes
+			// shorter than PIN_MIN_DIGITS are rejected by pinStore().
+			if (entryLength == 0)
+			{
+				pinClear(entrySlot);
+				display(SLOTCLEARED);
+				return ENTRY_SAVED;
+			}
+			if (!pinStore(entrySlot))
+			{
+				display(PINREJECTED);
+				return ENTRY_WRONG;
+			}
+			display(SETPASSWORD);
+			return ENTRY_SAVED;
+	}
+}
+
+// Check if a password entry is in progress
+uint8_t
+entryActive()
+{
+	return entryRunning;
+}
+
+// End a password entry early and show why on the LCD
+void
+entryAbort(uint8_t code)
+{
+	if (!entryRunning)
+	{
+		return;
+	}
+	entryRunning = 0;
+	timerCancel(&entryTimer);
+	displayInput('#', entryLength);
+	display(code);
+	return;
+}
+
+// Feed a key to the password entry, 0 if none was pressed. Returns
+// ENTRY_BUSY until the entry finishes, then whether the password was
+// correct or saved. PINs take PIN_MIN_DIGITS to PIN_MAX_DIGITS digits. An
+// entry left alone for ENTRY_TIMEOUT is cancelled.
+uint8_t
+entryUpdate(char key)
+{
+	if (!entryRunning)
+	{
+		return ENTRY_IDLE;
+	}
+	if (entryTimedOut)
+	{
+		entryAbort(ENTRYCANCEL);
+		return ENTRY_CANCELLED;
+	}
+	
+	// Slot numbers are short and not secret, PINs are hashed digit by digit
+	uint8_t maxLength = entryPrompt == PROMPT_SLOT ? 2 : PIN_MAX_DIGITS;
+	uint8_t minLength = PIN_MIN_DIGITS;
+	if (entryPrompt == PROMPT_SLOT)
+	{
+		minLength = 1;
+	}
+	else if (entryPrompt == PROMPT_NEWPIN && entrySlot != PIN_MASTER)
+	{
+		minLength = 0;
+	}
+	
+	// Check if input is a character between 0-9, inform the LCD and add it
+	if (key > 47 && key < 58 && entryLength < maxLength)
+	{
+		if (entryPrompt == PROMPT_SLOT)
 		{
-			inputsGiven -= 1;
-			sendData('*');
-			_delay_ms(INPUTDELAY);
+			entrySlot = entrySlot * 10 + key - '0';
 		}
 		else
 		{
-			// Ignore other inputs
+			pinAbsorb(key);
 		}
+		entryLength += 1;
+		displayInput(key, entryLength - 1);
 	}
-
-	// Check if the given password matches the real one
-	for (uint8_t i = 0; i < 4; i++)
+	// If * is pressed, inform the LCD and go back one index
+	else if (key == '*' && entryLength > 0)
 	{
-		if (inputPassword[i] != password[i])
+		if (entryPrompt == PROMPT_SLOT)
 		{
-			passwordIsCorrect = 0;
-			break;
+			entrySlot /= 10;
 		}
+		else
+		{
+			pinErase();
+		}
+		entryLength -= 1;
+		displayInput('*', entryLength);
 	}
-	// Inform the LCD whether the password was correct or not
-	if (passwordIsCorrect)
+	// Keep waiting for # after enough inputs, ignore other inputs
+	else if (key != '#' || entryLength < minLength)
 	{
-		sendData(CORRECTPASS);
+		if (key)
+		{
+			timerStart(&entryTimer, ENTRY_TIMEOUT, entryExpired);
+		}
+		return ENTRY_BUSY;
 	}
 	else
 	{
-		sendData(WRONGPASS);	
+		displayInput('#', entryLength);
+		entryRunning = 0;
+		timerCancel(&entryTimer);
+		uint8_t result = entryFinish();
+		traceEvent(TRACE_ENTRY, result);
+		if (result != ENTRY_BUSY)
+		{
+			waitMs(1000); // Delay so the message isnt immediately overwritten
+		}
+		return result;
 	}
-
-	_delay_ms(1000); // Delay so the message isnt immediately overwritten
-	return passwordIsCorrect;	
+	
+	timerStart(&entryTimer, ENTRY_TIMEOUT, entryExpired);
+	return ENTRY_BUSY;
 }
 
 int
 main(void)
 {
-	sei();
+	halInterruptsOn();
+	// Start the timers first so time to ready covers the whole boot
+	initTimers();
 	
 	// Set used pins as inputs/outputs
-	DDRE |= (1 << TRIGGER_PIN);
-	DDRE &= ~(1 << ECHO_PIN);
-	DDRE |= (1 << BUZZER_PIN);
+	halSensorInit();
 	
-	// Create and load password from EEPROM
-	char password[4];
-	loadPassword(password);
+	// Load the password hash from EEPROM, a lockout carries on after a reset
+	pinLoad();
 	
-	// Initialize everything, connect to the LCD and set state as disarmed
+	// Initialize everything and set state as disarmed right away, the LCD
+	// connects through serviceLink() whenever it is ready
 	initSerial();
-	initTimers();
+	initDebug();
 	KEYPAD_Init();
-	attemptConnection();
-	_delay_ms(500);
+	lockoutStart();
 	state = DISARMED;
 	
+	// Report time to ready
+	char line[32];
+	snprintf(line, sizeof(line), "ready in %lu us\r\n", clockMicros());
+	debugPrint(line);
+	watchdogReport(debugPrint);
+#if PIN_BENCHMARK
+	pinBenchmark(debugPrint);
+#endif
+	
+	// Supervise the main loop from here on
+	watchdogStart();
 	while (1)
 	{
+		uint8_t result;
+		traceEvent(TRACE_STATE, state);
+		profileState(state - ARMED);
+		watchdogCheckIn();
 		switch (state)
 		{
 			case ARMED:
-				sendData(ARMED);
-				_delay_ms(INPUTDELAY);
+				display(ARMED);
+				// Force telemetry to be resent since the LCD was cleared
+				lastTelemetryDistance = 255;
+				holdKeys();
 				while (1)
 				{
-					char key = KEYPAD_GetKey();
-					if (key == '#')
+					profileLoop();
+					watchdogCheckIn();
+					service();
+					char key = readKey();
+					// Keep ranging while a password is being entered so
+					// motion is never missed, the entry carries over into
+					// the MOVEMENT state
+					uint8_t distance = getDistance();
+					if (entryActive())
 					{
-						if(checkPassword(password, 0))
+						result = entryUpdate(key);
+						if (result == ENTRY_CORRECT)
 						{
 							state = DISARMED;
 							break;
 						}
-						else
+						else if (result == ENTRY_WRONG)
 						{
 							state = TRIGGERED;
 							break;
 						}
+						else if (result == ENTRY_CANCELLED)
+						{
+							timerStart(&redrawTimer, 1000, redrawState);
+						}
 					}
-					else if (getDistance() < TRIGGER_DIST)
+					else
+					{
+						// The input and lockout screens use the telemetry
+						// line
+						if (!lockoutShown)
+						{
+							sendTelemetry(distance);
+						}
+						if (key == '#')
+						{
+							entryStart(PROMPT_CHECK);
+						}
+					}
+					if (distance < TRIGGER_DIST)
 					{
 						state = MOVEMENT;
 						break;
@@ -382,69 +1316,136 @@ main(void)
 				break;
 			
 			case MOVEMENT:
-				sendData(MOVEMENT);
-				TCNT5 = 0;
-				secondsElapsed = 0;
-				_delay_ms(INPUTDELAY);
+				// Leave the input screen up if the user is already typing
+				if (!entryActive())
+				{
+					display(MOVEMENT);
+				}
+				sirenStart(SIREN_CHIRP);
+				// Start the entry delay and its countdown
+				alarmTimedOut = 0;
+				timerStart(&alarmTimer, ALARM_DELAY * 1000UL, alarmExpired);
+				countdownRemaining = ALARM_DELAY;
+				displayCountdown(countdownRemaining);
+				timerStart(&countdownTimer, 1000, countdownTick);
+				holdKeys();
 				while (1)
 				{
-					char key = KEYPAD_GetKey();
-					// Wait until # to start inputting password
-					if (key == '#')
+					profileLoop();
+					watchdogCheckIn();
+					service();
+					char key = readKey();
+					if (entryActive())
 					{
-						if(checkPassword(password, 1))
+						result = entryUpdate(key);
+						if (result == ENTRY_CORRECT)
 						{
 							state = DISARMED;
 							break;
 						}
-						else
+						else if (result == ENTRY_WRONG)
 						{
 							state = TRIGGERED;
 							break;
 						}
+						else if (result == ENTRY_CANCELLED)
+						{
+							timerStart(&redrawTimer, 1000, redrawState);
+						}
+					}
+					// Wait until # to start inputting password
+					else if (key == '#')
+					{
+						entryStart(PROMPT_CHECK);
 					}
-					// If no input is given, trigger the alarm
-					else if (secondsElapsed > ALARM_DELAY)
+					// If the password isn't given in time, trigger the alarm
+					if (alarmTimedOut)
 					{
-						sendData(ALARMTIMEOUT);
-						_delay_ms(1000);
+						if (entryActive())
+						{
+							entryAbort(ALARMTIMEOUT);
+						}
+						else
+						{
+							display(ALARMTIMEOUT);
+						}
+						waitMs(1000);
 						state = TRIGGERED;
 						break;
 					}
 				}
+				timerCancel(&alarmTimer);
+				timerCancel(&countdownTimer);
 				break;
 			
 			case DISARMED:
-				sendData(DISARMED);
-				_delay_ms(INPUTDELAY);
+				sirenStop();
+				display(DISARMED);
+				holdKeys();
 				while (1)
 				{
-					char key = KEYPAD_GetKey();
-					if (key == '*')
+					profileLoop();
+					watchdogCheckIn();
+					service();
+					char key = readKey();
+					if (entryActive())
 					{
-						setPassword(password);
-						break;
+						result = entryUpdate(key);
+						// Show the state again after the outcome
+						if (result == ENTRY_SAVED || result == ENTRY_WRONG)
+						{
+							break;
+						}
+						else if (result == ENTRY_CANCELLED)
+						{
+							timerStart(&redrawTimer, 1000, redrawState);
+						}
+					}
+					else if (key == '*')
+					{
+						entryStartChange();
 					}
 					else if (key == '#')
 					{
 						state = ARMED;
 						break;
 					}
-					else
+					else if (linkStatsDue && !lockoutShown)
 					{
-						// Ignore other inputs
+						sendLinkStats();
 					}
 				}
 				break;
 			
 			case TRIGGERED:
-				enableBuzzer();
+				sirenStart(SIREN_SWEEP);
 				// Wait for the LCD to display the reason for the alarm
-				_delay_ms(1000);
+				waitMs(1000);
 				
-				// Loop until correct password is given, then disarm system
-				while (checkPassword(password, 0) == 0);
-				disableBuzzer();
+				// Loop until correct password is given, then disarm system.
+				// The siren keeps going during a lockout and the entry
+				// starts again once it is over.
+				entryStart(PROMPT_CHECK);
+				while (1)
+				{
+					profileLoop();
+					watchdogCheckIn();
+					service();
+					result = entryUpdate(readKey());
+					if (result == ENTRY_CORRECT)
+					{
+						break;
+					}
+					else if (result == ENTRY_CANCELLED)
+					{
+						waitMs(1000);
+					}
+					if (!entryActive() && !lockedOut())
+					{
+						entryStart(PROMPT_CHECK);
+					}
+				}
+				sirenStop();
 				state = DISARMED;
 				break;
 		}
@@ -0,0 +1,497 @@
+/*
+ * pin.c
+ *
+ * Each digit is absorbed as one 64 bit SipHash message word holding the
+ * digit and its position, with the usual two compression rounds. After
+ * every digit a copy of the state is finalized with the length word and
+ * four rounds, and the states and tags of all lengths are kept so '*' can
+ * step back without the digits themselves ever being stored. SipHash only
+ * adds, rotates by constants and xors, so hashing takes the same time for
+ * every digit.
+ *
+ * The tags of all slots are kept in RAM as the lookup index. pinFind()
+ * compares the entry with every slot whether it is used or not, so the
+ * time taken depends neither on the code nor on how many slots are set.
+ *
+ * EEPROM layout: the first firmware kept the PIN as four ASCII digits at
+ * PIN_LEGACY_ADDRESS, the next one a marker, salt and tag for a single PIN
+ * at PIN_SINGLE_ADDRESS. The record at PIN_RECORD_ADDRESS holds a marker,
+ * the salt and a used flag and tag for every slot. Older PINs become the
+ * master code on the first boot and are then wiped. The count of wrong
+ * codes in a row is kept at PIN_FAILURES_ADDRESS so a reset doesn't clear
+ * it.
+ */ 
+
+#include <stdio.h>
+#include "hal.h"
+#include "clock.h"
+#include "pin.h"
+
+#define PIN_LEGACY_ADDRESS 0	// Plain text PIN of the first firmware
+#define PIN_SINGLE_ADDRESS 16	// Marker, salt and tag of a single PIN
+#define PIN_SINGLE_MARKER 0xA5	// Marks a valid single PIN record
+#define PIN_FAILURES_ADDRESS 48	// Wrong codes in a row, 0xFF when never written
+#define PIN_FAILURES_MAX 254	// Failure count saturates here
+#define PIN_RECORD_ADDRESS 64	// Marker, salt and slots
+#define PIN_MARKER 0xA6	// Marks a valid record
+#define PIN_SALT_ADDRESS (PIN_RECORD_ADDRESS + 1)
+#define PIN_SLOT_ADDRESS(slot) (PIN_SALT_ADDRESS + PIN_SALT_SIZE + (slot) * (1 + PIN_TAG_SIZE))
+
+#define ROTL(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+struct pinState {
+	uint64_t v[4];
+	uint8_t tag[PIN_TAG_SIZE];
+};
+
+static uint8_t salt[PIN_SALT_SIZE];
+static uint8_t hasSalt = 0;
+static uint8_t used[PIN_SLOTS];
+static uint8_t tags[PIN_SLOTS][PIN_TAG_SIZE];
+static uint8_t failures = 0;
+
+// Hash states after 0 to PIN_MAX_DIGITS digits of the current entry
+static struct pinState states[PIN_MAX_DIGITS + 1];
+static uint8_t length = 0;
+
+static uint64_t
+load64(const uint8_t *bytes)
+{
+	uint64_t value = 0;
+	for (uint8_t i = 8; i > 0; i--)
+	{
+		value = (value << 8) | bytes[i - 1];
+	}
+	return value;
+}
+
+static void
+sipRound(uint64_t v[4])
+{
+	v[0] += v[1];
+	v[1] = ROTL(v[1], 13);
+	v[1] ^= v[0];
+	v[0] = ROTL(v[0], 32);
+	v[2] += v[3];
+	v[3] = ROTL(v[3], 16);
+	v[3] ^= v[2];
+	v[0] += v[3];
+	v[3] = ROTL(v[3], 21);
+	v[3] ^= v[0];
+	v[2] += v[1];
+	v[1] = ROTL(v[1], 17);
+	v[1] ^= v[2];
+	v[2] = ROTL(v[2], 32);
+	return;
+}
+
+static void
+sipCompress(uint64_t v[4], uint64_t word)
+{
+	v[3] ^= word;
+	sipRound(v);
+	sipRound(v);
+	v[0] ^= word;
+	return;
+}
+
+// Start a SipHash state keyed with the given salt
+static void
+sipInit(uint64_t v[4], const uint8_t key[PIN_SALT_SIZE])
+{
+	uint64_t k0 = load64(key);
+	uint64_t k1 = load64(key + 8);
+	v[0] = k0 ^ 0x736f6d6570736575ULL;
+	v[1] = k1 ^ 0x646f72616e646f6dULL;
+	v[2] = k0 ^ 0x6c7967656e657261ULL;
+	v[3] = k1 ^ 0x7465646279746573ULL;
+	return;
+}
+
+// Finalize a copy of the state after the given number of words
+static void
+sipFinish(const uint64_t state[4], uint8_t words, uint8_t out[PIN_TAG_SIZE])
+{
+	uint64_t v[4] = { state[0], state[1], state[2], state[3] };
+	sipCompress(v, (uint64_t) words << 56);
+	v[2] ^= 0xFF;
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		sipRound(v);
+	}
+	uint64_t result = v[0] ^ v[1] ^ v[2] ^ v[3];
+	for (uint8_t i = 0; i < PIN_TAG_SIZE; i++)
+	{
+		out[i] = (uint8_t) result;
+		result >>= 8;
+	}
+	return;
+}
+
+// Make a salt from the time the first entry started, which depends on when
+// the user pressed the keys. It is only kept once the first PIN is saved,
+// after that it never changes since the PINs can't be hashed again.
+static void
+makeSalt(void)
+{
+	uint8_t seed[PIN_SALT_SIZE];
+	uint64_t v[4];
+	uint32_t now = clockMicros();
+	for (uint8_t i = 0; i < PIN_SALT_SIZE; i++)
+	{
+		seed[i] = salt[i];
+	}
+	for (uint8_t half = 0; half < 2; half++)
+	{
+		sipInit(v, seed);
+		sipCompress(v, ((uint64_t) half << 32) | now);
+		sipFinish(v, 1, salt + half * 8);
+	}
+	return;
+}
+
+// Write the salt and the marker after it, which makes the record valid with
+// all slots unused
+static void
+storeSalt(void)
+{
+	for (uint8_t slot = 0; slot < PIN_SLOTS; slot++)
+	{
+		halEepromWrite(PIN_SLOT_ADDRESS(slot), 0);
+	}
+	for (uint8_t i = 0; i < PIN_SALT_SIZE; i++)
+	{
+		halEepromWrite(PIN_SALT_ADDRESS + i, salt[i]);
+	}
+	halEepromWrite(PIN_RECORD_ADDRESS, PIN_MARKER);
+	hasSalt = 1;
+	return;
+}
+
+// Write a tag into a slot, without the checks of pinStore(). The used flag
+// goes last so a reset halfway leaves the slot unused rather than half
+// written. Returns 1 if the EEPROM reads back the whole slot.
+static uint8_t
+storeTag(uint8_t slot, const uint8_t tag[PIN_TAG_SIZE])
+{
+	uint16_t address = PIN_SLOT_ADDRESS(slot);
+	uint8_t difference = 0;
+	halEepromWrite(address, 0);
+	for (uint8_t i = 0; i < PIN_TAG_SIZE; i++)
+	{
+		tags[slot][i] = tag[i];
+		halEepromWrite(address + 1 + i, tag[i]);
+		difference |= halEepromRead(address + 1 + i) ^ tag[i];
+	}
+	halEepromWrite(address, 1);
+	difference |= halEepromRead(address) ^ 1;
+	used[slot] = difference == 0;
+	return used[slot];
+}
+
+// Load the salt and the slots from EEPROM into the index, converting a PIN
+// left by older firmware into the master code. The old PIN is only wiped
+// once the master slot holds it. Without any no PIN is
+// accepted until the master code is set.
+void
+pinLoad(void)
+{
+	for (uint8_t slot = 0; slot < PIN_SLOTS; slot++)
+	{
+		used[slot] = 0;
+	}
+	failures = halEepromRead(PIN_FAILURES_ADDRESS);
+	if (failures > PIN_FAILURES_MAX)
+	{
+		failures = 0;
+	}
+	if (halEepromRead(PIN_RECORD_ADDRESS) == PIN_MARKER)
+	{
+		for (uint8_t i = 0; i < PIN_SALT_SIZE; i++)
+		{
+			salt[i] = halEepromRead(PIN_SALT_ADDRESS + i);
+		}
+		for (uint8_t slot = 0; slot < PIN_SLOTS; slot++)
+		{
+			uint16_t address = PIN_SLOT_ADDRESS(slot);
+			used[slot] = halEepromRead(address) == 1;
+			for (uint8_t i = 0; i < PIN_TAG_SIZE; i++)
+			{
+				tags[slot][i] = halEepromRead(address + 1 + i);
+			}
+		}
+		hasSalt = 1;
+		return;
+	}
+	
+	// A single hashed PIN keeps its salt and tag
+	if (halEepromRead(PIN_SINGLE_ADDRESS) == PIN_SINGLE_MARKER)
+	{
+		for (uint8_t i = 0; i < PIN_SALT_SIZE; i++)
+		{
+			salt[i] = halEepromRead(PIN_SINGLE_ADDRESS + 1 + i);
+		}
+		storeSalt();
+		// The old tag is the tag an entry of the same PIN gets, it has no
+		// length to check
+		uint8_t tag[PIN_TAG_SIZE];
+		for (uint8_t i = 0; i < PIN_TAG_SIZE; i++)
+		{
+			tag[i] = halEepromRead(PIN_SINGLE_ADDRESS + 1 + PIN_SALT_SIZE + i);
+		}
+		if (storeTag(PIN_MASTER, tag))
+		{
+			halEepromWrite(PIN_SINGLE_ADDRESS, 0xFF);
+		}
+		return;
+	}
+	
+	// A plain text PIN is hashed under a new salt
+	char legacy[4];
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		legacy[i] = halEepromRead(PIN_LEGACY_ADDRESS + i);
+		if (legacy[i] < '0' || legacy[i] > '9')
+		{
+			return;
+		}
+	}
+	pinBegin();
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		pinAbsorb(legacy[i]);
+		legacy[i] = 0;
+	}
+	if (!pinStore(PIN_MASTER))
+	{
+		return;
+	}
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		halEepromWrite(PIN_LEGACY_ADDRESS + i, 0xFF);
+	}
+	return;
+}
+
+// Start hashing a new entry. Until the first PIN is saved every entry gets
+// a fresh salt.
+void
+pinBegin(void)
+{
+	if (!hasSalt)
+	{
+		makeSalt();
+	}
+	sipInit(states[0].v, salt);
+	sipFinish(states[0].v, 0, states[0].tag);
+	length = 0;
+	return;
+}
+
+// Hash the next digit of the entry
+void
+pinAbsorb(char digit)
+{
+	if (length >= PIN_MAX_DIGITS)
+	{
+		return;
+	}
+	struct pinState *from = &states[length];
+	struct pinState *to = &states[length + 1];
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		to->v[i] = from->v[i];
+	}
+	length += 1;
+	sipCompress(to->v, ((uint64_t) length << 8) | (uint8_t) digit);
+	sipFinish(to->v, length, to->tag);
+	return;
+}
+
+// Drop the last digit of the entry
+void
+pinErase(void)
+{
+	if (length > 0)
+	{
+		length -= 1;
+	}
+	return;
+}
+
+// Get the number of digits in the entry
+uint8_t
+pinLength(void)
+{
+	return length;
+}
+
+// Compare the entry with one slot, 0 if they match. Every byte is compared
+// whatever the earlier ones were.
+static uint8_t
+compareSlot(uint8_t slot)
+{
+	uint8_t difference = used[slot] ^ 1;
+	for (uint8_t i = 0; i < PIN_TAG_SIZE; i++)
+	{
+		difference |= states[length].tag[i] ^ tags[slot][i];
+	}
+	return difference;
+}
+
+// Get the slot whose code matches the entry, or PIN_NONE. Every slot is
+// compared and the match is picked with a mask instead of a branch, so the
+// time taken doesn't tell whether or where a code matched.
+uint8_t
+pinFind(void)
+{
+	uint8_t found = PIN_NONE;
+	for (uint8_t slot = 0; slot < PIN_SLOTS; slot++)
+	{
+		// 0xFF if the slot matches, 0 otherwise
+		uint8_t mask = (uint8_t) (((uint16_t) compareSlot(slot) - 1) >> 8);
+		found = (found & ~mask) | (slot & mask);
+	}
+	if (length < PIN_MIN_DIGITS)
+	{
+		return PIN_NONE;
+	}
+	return found;
+}
+
+// Save the entry as the code of a slot. Returns 0 without saving if the
+// entry is too short for pinFind() to ever match it, or if another slot
+// already has the same code, since an entry must find one slot only.
+uint8_t
+pinStore(uint8_t slot)
+{
+	if (length < PIN_MIN_DIGITS)
+	{
+		return 0;
+	}
+	uint8_t owner = pinFind();
+	if (owner != PIN_NONE && owner != slot)
+	{
+		return 0;
+	}
+	if (!hasSalt)
+	{
+		storeSalt();
+	}
+	return storeTag(slot, states[length].tag);
+}
+
+// Remove the code of a slot
+void
+pinClear(uint8_t slot)
+{
+	halEepromWrite(PIN_SLOT_ADDRESS(slot), 0);
+	used[slot] = 0;
+	return;
+}
+
+// Check if a slot has a code
+uint8_t
+pinSlotUsed(uint8_t slot)
+{
+	return used[slot];
+}
+
+// Get the number of wrong codes entered in a row
+uint8_t
+pinFailures(void)
+{
+	return failures;
+}
+
+// Count a wrong code
+void
+pinFailed(void)
+{
+	if (failures < PIN_FAILURES_MAX)
+	{
+		failures += 1;
+		halEepromWrite(PIN_FAILURES_ADDRESS, failures);
+	}
+	return;
+}
+
+// Clear the wrong code count after a right code
+void
+pinPassed(void)
+{
+	if (failures != 0)
+	{
+		failures = 0;
+		halEepromWrite(PIN_FAILURES_ADDRESS, failures);
+	}
+	return;
+}
+
+// Measure the cycles taken to hash a digit and to look up an entry with
+// timer 1. Hashing is timed for every digit at every position, lookups with
+// 0 to PIN_SLOTS slots filled and the entry matching each of them in turn.
+// The index is filled in RAM only and reloaded from EEPROM afterwards.
+// Interrupts are held off while measuring so the counts are exact, the
+// system clock falls a few milliseconds behind.
+void
+pinBenchmark(void (*print)(const char *text))
+{
+	uint32_t absorbMin = 0xFFFFFFFF;
+	uint32_t absorbMax = 0;
+	uint32_t findMin = 0xFFFFFFFF;
+	uint32_t findMax = 0;
+	volatile uint8_t found;
+	uint16_t saved = halCyclesOpen();
+	
+	pinBegin();
+	for (uint8_t position = 0; position < PIN_MAX_DIGITS; position++)
+	{
+		for (char digit = '0'; digit <= '9'; digit++)
+		{
+			uint8_t sreg = halInterruptsSave();
+			halCyclesStart();
+			pinAbsorb(digit);
+			uint32_t cycles = halCyclesTaken();
+			halInterruptsRestore(sreg);
+			pinErase();
+			absorbMin = cycles < absorbMin ? cycles : absorbMin;
+			absorbMax = cycles > absorbMax ? cycles : absorbMax;
+		}
+		pinAbsorb('0' + position);
+	}
+	
+	for (uint8_t filled = 0; filled <= PIN_SLOTS; filled++)
+	{
+		for (uint8_t slot = 0; slot < PIN_SLOTS; slot++)
+		{
+			used[slot] = slot < filled;
+			tags[slot][0] = slot;
+		}
+		// Match no slot, then every filled slot in turn
+		for (uint8_t match = 0; match <= filled; match++)
+		{
+			for (uint8_t i = 0; i < PIN_TAG_SIZE; i++)
+			{
+				states[length].tag[i] = match < filled ? tags[match][i] : 0xFF;
+			}
+			uint8_t sreg = halInterruptsSave();
+			halCyclesStart();
+			found = pinFind();
+			uint32_t cycles = halCyclesTaken();
+			halInterruptsRestore(sreg);
+			findMin = cycles < findMin ? cycles : findMin;
+			findMax = cycles > findMax ? cycles : findMax;
+		}
+	}
+	(void) found;
+	pinLoad();
+	pinBegin();
+	halCyclesClose(saved);
+	
+	char line[80];
+	snprintf(line, sizeof(line), "pin digit %lu-%lu cycles, lookup %lu-%lu cycles\r\n",
+		absorbMin, absorbMax, findMin, findMax);
+	print(line);
+	return;
+}
@@ -0,0 +1,43 @@
+/*
+ * pin.h
+ *
+ * PIN verification against salted SipHash-2-4 tags kept in EEPROM. PINs
+ * themselves are never stored. Every digit is hashed as it is typed and the
+ * finished tag for the digits so far is computed right away, so '#' only
+ * has to look the tag up, which is done in constant time.
+ *
+ * There are PIN_SLOTS codes of PIN_MIN_DIGITS to PIN_MAX_DIGITS digits
+ * sharing one salt, so an entry is hashed once whatever the number of
+ * codes. Slot 0 is the master code that can change the others, the slots
+ * from PIN_DURESS_FIRST on are duress codes.
+ */ 
+
+#ifndef PIN_H
+#define PIN_H
+
+#include <stdint.h>
+
+#define PIN_MIN_DIGITS 4	// Shortest PIN
+#define PIN_MAX_DIGITS 8	// Longest PIN
+#define PIN_SLOTS 16	// Number of codes
+#define PIN_MASTER 0	// Slot of the master code
+#define PIN_DURESS_FIRST 12	// First slot of the duress codes
+#define PIN_NONE 0xFF	// No slot
+#define PIN_SALT_SIZE 16	// SipHash key
+#define PIN_TAG_SIZE 8	// SipHash output
+
+void pinLoad(void);
+void pinBegin(void);
+void pinAbsorb(char digit);
+void pinErase(void);
+uint8_t pinLength(void);
+uint8_t pinFind(void);
+uint8_t pinStore(uint8_t slot);
+void pinClear(uint8_t slot);
+uint8_t pinSlotUsed(uint8_t slot);
+uint8_t pinFailures(void);
+void pinFailed(void);
+void pinPassed(void);
+void pinBenchmark(void (*print)(const char *text));
+
+#endif
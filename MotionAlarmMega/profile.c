@@ -0,0 +1,166 @@
+/*
+ * profile.c
+ *
+ * Subsystem time, state residency and main loop iteration counters.
+ */ 
+
+#include <stdio.h>
+#include "clock.h"
+#include "profile.h"
+
+static const char *subsystemNames[PROFILE_SUBSYSTEMS] = {
+	"main", "ranging", "keypad", "link", "timers", "debug", "wait"
+};
+
+// In the order of the state codes in main.c
+static const char *stateNames[PROFILE_STATES] = {
+	"armed", "movement", "disarmed", "triggered"
+};
+
+#if PROFILE_ENABLED
+// Sums of microseconds and iteration counts are 64 bit, in 32 bits they
+// would wrap after 71 minutes and a few days
+static uint64_t subsystemMicros[PROFILE_SUBSYSTEMS];
+static uint8_t subsystemCurrent = PROFILE_MAIN;
+static uint32_t subsystemSince = 0;
+
+static uint32_t stateMillis[PROFILE_STATES];
+static uint8_t stateCurrent = 0;
+static uint32_t stateSince = 0;
+
+static uint32_t loopMax[PROFILE_STATES];
+static uint64_t loopTotal[PROFILE_STATES];
+static uint64_t loopCount[PROFILE_STATES];
+static uint8_t loopStarted = 0;
+static uint32_t loopStart = 0;
+static uint32_t loopWaited = 0;
+static uint32_t profileSince = 0;
+
+// Charge the time since the last switch to the current subsystem and
+// switch to the given one. Returns the subsystem to switch back to.
+uint8_t
+profileEnter(uint8_t subsystem)
+{
+	uint32_t now = clockMicros();
+	subsystemMicros[subsystemCurrent] += now - subsystemSince;
+	subsystemSince = now;
+	uint8_t previous = subsystemCurrent;
+	subsystemCurrent = subsystem;
+	return previous;
+}
+
+// Charge the time since the last state change to the current state
+static void
+stateCharge(void)
+{
+	uint32_t now = clockMillis();
+	stateMillis[stateCurrent] += now - stateSince;
+	stateSince = now;
+	return;
+}
+
+// Note that the given state was entered. The first iteration of its loop is
+// timed from the loop itself, so the work done on entering the state
+// doesn't count as an iteration.
+void
+profileState(uint8_t index)
+{
+	stateCharge();
+	stateCurrent = index < PROFILE_STATES ? index : 0;
+	loopStarted = 0;
+	return;
+}
+
+// Time one iteration of the current state's loop, call at the top of it
+void
+profileLoop(void)
+{
+	// Bring the wait time up to date, the loop isn't in a subsystem here
+	profileEnter(subsystemCurrent);
+	uint32_t now = subsystemSince;
+	uint32_t waited = (uint32_t) subsystemMicros[PROFILE_WAIT];
+	if (loopStarted)
+	{
+		uint32_t iteration = (now - loopStart) - (waited - loopWaited);
+		if (iteration > loopMax[stateCurrent])
+		{
+			loopMax[stateCurrent] = iteration;
+		}
+		loopTotal[stateCurrent] += iteration;
+		loopCount[stateCurrent] += 1;
+	}
+	loopStarted = 1;
+	loopStart = now;
+	loopWaited = waited;
+	return;
+}
+
+// Clear every counter, the current subsystem and state carry on
+void
+profileReset(void)
+{
+	for (uint8_t i = 0; i < PROFILE_SUBSYSTEMS; i++)
+	{
+		subsystemMicros[i] = 0;
+	}
+	for (uint8_t i = 0; i < PROFILE_STATES; i++)
+	{
+		stateMillis[i] = 0;
+		loopMax[i] = 0;
+		loopTotal[i] = 0;
+		loopCount[i] = 0;
+	}
+	subsystemSince = clockMicros();
+	stateSince = clockMillis();
+	profileSince = stateSince;
+	loopStarted = 0;
+	return;
+}
+
+// Print the counters since boot or the last reset, one line at a time
+void
+profileReport(void (*print)(const char *text))
+{
+	char line[64];
+	profileEnter(subsystemCurrent);
+	stateCharge();
+	
+	uint64_t total = 0;
+	for (uint8_t i = 0; i < PROFILE_SUBSYSTEMS; i++)
+	{
+		total += subsystemMicros[i];
+	}
+	snprintf(line, sizeof(line), "profile over %lu ms\r\n",
+		clockMillis() - profileSince);
+	print(line);
+	for (uint8_t i = 0; i < PROFILE_SUBSYSTEMS; i++)
+	{
+		// Per mille of the total. printf() has no 64 bit numbers on the
+		// AVR, so the time is printed in milliseconds.
+		uint32_t share = total >= 1000
+			? (uint32_t) (subsystemMicros[i] / (total / 1000)) : 0;
+		snprintf(line, sizeof(line), "%-9s %10lu ms %3lu.%lu%%\r\n",
+			subsystemNames[i], (uint32_t) (subsystemMicros[i] / 1000),
+			share / 10, share % 10);
+		print(line);
+	}
+	for (uint8_t i = 0; i < PROFILE_STATES; i++)
+	{
+		uint32_t average = loopCount[i]
+			? (uint32_t) (loopTotal[i] / loopCount[i]) : 0;
+		snprintf(line, sizeof(line), "%-9s %10lu ms, loop avg %lu us max %lu us\r\n",
+			stateNames[i], stateMillis[i], average, loopMax[i]);
+		print(line);
+	}
+	return;
+}
+#else
+void
+profileReport(void (*print)(const char *text))
+{
+	(void) subsystemNames;
+	(void) stateNames;
+	print("profiling disabled\r\n");
+	return;
+}
+#endif
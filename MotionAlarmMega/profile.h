@@ -0,0 +1,51 @@
+/*
+ * profile.h
+ *
+ * Profiling counters kept from the timer 5 clock. Time is charged to one
+ * subsystem at a time: profileEnter() switches to a subsystem and returns
+ * the one it interrupted, which is switched back to when the subsystem is
+ * done, so nested subsystems are never counted twice. Whatever isn't in a
+ * subsystem is counted as PROFILE_MAIN. ISRs are charged to whatever they
+ * interrupted.
+ *
+ * The main loops also call profileLoop() once per iteration for the longest
+ * and average iteration of every state, i.e. how long a key or an echo can
+ * wait to be looked at. Time held in waitMs() is left out of the
+ * iterations, it is counted as PROFILE_WAIT instead.
+ */ 
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 1	// 0 compiles the counters out
+#endif
+
+// Subsystems
+#define PROFILE_MAIN 0	// State logic, password entry and display
+#define PROFILE_RANGING 1	// getDistance()
+#define PROFILE_KEYPAD 2	// Keypad scan
+#define PROFILE_LINK 3	// Bytes received from the atmega328p
+#define PROFILE_TIMERS 4	// Software timers and their callbacks
+#define PROFILE_DEBUG 5	// Trace output and the debug console
+#define PROFILE_WAIT 6	// Holds in waitMs()
+#define PROFILE_SUBSYSTEMS 7
+
+#define PROFILE_STATES 4	// ARMED, MOVEMENT, DISARMED and TRIGGERED
+
+#if PROFILE_ENABLED
+uint8_t profileEnter(uint8_t subsystem);
+void profileState(uint8_t index);
+void profileLoop(void);
+void profileReset(void);
+#else
+static inline uint8_t profileEnter(uint8_t subsystem) { (void) subsystem; return PROFILE_MAIN; }
+static inline void profileState(uint8_t index) { (void) index; }
+static inline void profileLoop(void) {}
+static inline void profileReset(void) {}
+#endif
+void profileReport(void (*print)(const char *text));
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * screen.c
+ *
+ * Screen model and delta encoder for the remote display mode.
+ */ 
+
+#include "screen.h"
+#include "trace.h"
+
+#if LINK_FRAME_SIZE < SCREEN_SIZE + 3
+#error "LINK_FRAME_SIZE can't hold the longest screen delta"
+#endif
+
+// Characters as drawn and as last sent to the atmega328p
+static char screen[SCREEN_SIZE];
+static char shown[SCREEN_SIZE];
+
+// Fill the screen with spaces
+void
+screenClear(void)
+{
+	for (uint8_t i = 0; i < SCREEN_SIZE; i++)
+	{
+		screen[i] = ' ';
+	}
+	return;
+}
+
+// Draw a character, replacing anything that isn't printable
+void
+screenPutc(uint8_t x, uint8_t y, char c)
+{
+	if (x >= SCREEN_COLUMNS || y >= SCREEN_ROWS)
+	{
+		return;
+	}
+	if (c < ' ' || c >= SCREEN_END)
+	{
+		c = '?';
+	}
+	screen[y * SCREEN_COLUMNS + x] = c;
+	return;
+}
+
+// Draw a string without wrapping, characters past the line end are dropped
+void
+screenPrint(uint8_t x, uint8_t y, const char *text)
+{
+	while (*text && x < SCREEN_COLUMNS)
+	{
+		screenPutc(x++, y, *text++);
+	}
+	return;
+}
+
+// Forget what the atmega328p shows so the next flush repaints everything
+void
+screenInvalidate(void)
+{
+	for (uint8_t i = 0; i < SCREEN_SIZE; i++)
+	{
+		shown[i] = 0;
+	}
+	return;
+}
+
+// Write the changed characters into frame as a delta frame starting with
+// header, returning 0 if the screen hasn't changed and there is nothing to
+// send. A position byte is only written when the changed cells aren't
+// consecutive.
+uint8_t
+screenFlush(uint8_t header, struct linkFrame *frame)
+{
+	uint8_t length = 0;
+	uint8_t cursor = SCREEN_SIZE;
+	for (uint8_t i = 0; i < SCREEN_SIZE; i++)
+	{
+		if (screen[i] == shown[i])
+		{
+			continue;
+		}
+		if (length == 0)
+		{
+			frame->bytes[length++] = header;
+		}
+		if (i != cursor)
+		{
+			frame->bytes[length++] = i;
+		}
+		frame->bytes[length++] = screen[i];
+		shown[i] = screen[i];
+		cursor = i + 1;
+	}
+	if (length == 0)
+	{
+		return 0;
+	}
+	frame->bytes[length++] = SCREEN_END;
+	frame->length = length;
+	traceEvent(TRACE_FLUSH, length);
+	return 1;
+}
@@ -0,0 +1,32 @@
+/*
+ * screen.h
+ *
+ * Model of the 16x2 LCD on the atmega328p for the remote display mode. The
+ * screen is drawn here and only the changed characters are sent over the
+ * link as a delta frame:
+ *
+ *     <header> [<position 0-31> <characters 32-126>...]... SCREEN_END
+ *
+ * A position byte moves the cursor, characters are written from there on
+ * and wrap from the first line to the second. screenFlush() writes the
+ * frame straight into a link frame, which is sent without another copy.
+ */ 
+
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stdint.h>
+#include "link.h"
+
+#define SCREEN_COLUMNS 16
+#define SCREEN_ROWS 2
+#define SCREEN_SIZE (SCREEN_COLUMNS * SCREEN_ROWS)
+#define SCREEN_END 127	// Ends a delta frame
+
+void screenClear(void);
+void screenPutc(uint8_t x, uint8_t y, char c);
+void screenPrint(uint8_t x, uint8_t y, const char *text);
+void screenInvalidate(void);
+uint8_t screenFlush(uint8_t header, struct linkFrame *frame);
+
+#endif
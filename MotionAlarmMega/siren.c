@@ -0,0 +1,141 @@
+/*
+ * siren.c
+ *
+ * Timer 3 runs in fast PWM mode 15 with OCR3A as TOP and OC3A toggling on
+ * every match, which gives a square wave at half the overflow rate. OCR3A
+ * is double buffered in this mode, so the overflow ISR can change the
+ * frequency glitch free. Every pattern step lasts a given number of
+ * toggles, during rest steps the output is disconnected from the pin.
+ */ 
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "siren.h"
+#include "latency.h"
+
+#define SIREN_TIMER_HZ 250000UL	// 16 MHz with a prescaler of 64
+
+// Pattern steps, a tone of freq Hz or a rest lasting ms milliseconds
+#define SIREN_TOP(freq) (SIREN_TIMER_HZ / 2 / (freq) - 1)
+#define SIREN_TOGGLES(freq, ms) (2UL * (freq) * (ms) / 1000)
+#define TONE(freq, ms) { SIREN_TOP(freq), SIREN_TOGGLES(freq, ms), 1 }
+#define REST(ms) { SIREN_TOP(1000), SIREN_TOGGLES(1000, ms), 0 }
+#define REPEAT { 0, 0, 0 }
+
+struct sirenStep {
+	uint16_t top;
+	uint16_t toggles;
+	uint8_t on;
+};
+
+// All patterns back to back, each ends by repeating from its start
+static const struct sirenStep sirenSteps[] PROGMEM = {
+	// SIREN_TONE
+	TONE(500, 1000), REPEAT,
+	// SIREN_CHIRP
+	TONE(2000, 50), REST(950), REPEAT,
+	// SIREN_CHIRP_FAST
+	TONE(2000, 50), REST(200), REPEAT,
+	// SIREN_SWEEP
+	TONE(600, 40), TONE(700, 40), TONE(800, 40), TONE(900, 40),
+	TONE(1000, 40), TONE(1100, 40), TONE(1200, 40), TONE(1300, 40),
+	TONE(1400, 40), TONE(1500, 40), TONE(1400, 40), TONE(1300, 40),
+	TONE(1200, 40), TONE(1100, 40), TONE(1000, 40), TONE(900, 40),
+	TONE(800, 40), TONE(700, 40), REPEAT,
+	// SIREN_PULSE
+	TONE(1000, 125), REST(125), REPEAT,
+};
+
+// Index of the first step of each pattern in sirenSteps
+static const uint8_t sirenStarts[SIREN_PATTERNS] = { 0, 2, 5, 8, 27 };
+
+static uint8_t sirenFirst = 0;
+static volatile uint8_t sirenIndex = 0;
+static volatile uint16_t sirenToggles = 0;
+
+// Load the current step, wrapping to the start of the pattern at its end
+static void
+sirenLoad(void)
+{
+	uint16_t toggles = pgm_read_word(&sirenSteps[sirenIndex].toggles);
+	if (toggles == 0)
+	{
+		sirenIndex = sirenFirst;
+		toggles = pgm_read_word(&sirenSteps[sirenIndex].toggles);
+	}
+	OCR3A = pgm_read_word(&sirenSteps[sirenIndex].top);
+	if (pgm_read_byte(&sirenSteps[sirenIndex].on))
+	{
+		TCCR3A |= (1 << COM3A0);
+	}
+	else
+	{
+		TCCR3A &= ~(1 << COM3A0);
+	}
+	sirenToggles = toggles;
+	return;
+}
+
+// Get the timer 3 counts since the overflow. The overflow is raised at TOP
+// and the count restarts from 0 on the next tick, so a count above half the
+// lowest TOP is still TOP.
+static inline uint8_t
+sirenTicks(void)
+{
+	uint8_t count = TCNT3L;
+	return count > SIREN_TOP(2000) / 2 ? 0 : count + 1;
+}
+
+// Timer 3 overflow ISR, counts down the toggles of the current step. Short
+// enough to run with interrupts off, see latency.h.
+ISR(TIMER3_OVF_vect)
+{
+	latencyStamp(LATENCY_SIREN, sirenTicks());
+	if (--sirenToggles == 0)
+	{
+		sirenIndex += 1;
+		sirenLoad();
+	}
+	latencyRelease(LATENCY_SIREN, sirenTicks());
+}
+
+// Start playing a pattern from its beginning, replacing the current one.
+// Safe to call from an ISR.
+void
+sirenStart(uint8_t pattern)
+{
+	if (pattern >= SIREN_PATTERNS)
+	{
+		return;
+	}
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		sirenFirst = sirenStarts[pattern];
+		sirenIndex = sirenFirst;
+		
+		// Fast PWM with OCR3A as TOP and a prescaler of 64
+		TCCR3B = 0;
+		TCNT3 = 0;
+		TCCR3A = (1 << WGM31) | (1 << WGM30);
+		sirenLoad();
+		TIFR3 = (1 << TOV3);
+		TIMSK3 |= (1 << TOIE3);
+		TCCR3B = (1 << WGM33) | (1 << WGM32) | (1 << CS31) | (1 << CS30);
+	}
+	return;
+}
+
+// Silence the buzzer and stop timer 3
+void
+sirenStop(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		TIMSK3 &= ~(1 << TOIE3);
+		TCCR3A = 0;
+		TCCR3B = 0;
+	}
+	return;
+}
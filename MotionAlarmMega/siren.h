@@ -0,0 +1,26 @@
+/*
+ * siren.h
+ *
+ * Buzzer patterns generated by timer 3. The tone is a square wave toggled
+ * on OC3A (the buzzer pin PE3) by the hardware and the timer 3 overflow ISR
+ * steps through a pattern table in program memory, so the main loop never
+ * has to time anything.
+ */ 
+
+#ifndef SIREN_H
+#define SIREN_H
+
+#include <stdint.h>
+
+// Patterns
+#define SIREN_TONE 0	// Steady 500 Hz tone
+#define SIREN_CHIRP 1	// Short chirp every second, for the entry delay
+#define SIREN_CHIRP_FAST 2	// Chirp four times a second, for the last seconds
+#define SIREN_SWEEP 3	// Rising and falling 600-1500 Hz sweep
+#define SIREN_PULSE 4	// 1 kHz pulses, four times a second
+#define SIREN_PATTERNS 5
+
+void sirenStart(uint8_t pattern);
+void sirenStop(void);
+
+#endif
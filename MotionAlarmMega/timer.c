@@ -0,0 +1,126 @@
+/*
+ * timer.c
+ *
+ * Hashed timer wheel on top of the millisecond system clock.
+ */ 
+
+#include "clock.h"
+#include "timer.h"
+
+#define TIMER_MASK (TIMER_SLOTS - 1)
+
+static Timer *slots[TIMER_SLOTS];
+static uint32_t wheelTime = 0;	// Last millisecond that has been serviced
+
+// Start the wheel from the current time, call after clockInit()
+void
+timerInit(void)
+{
+	for (uint8_t i = 0; i < TIMER_SLOTS; i++)
+	{
+		slots[i] = 0;
+	}
+	wheelTime = clockMillis();
+	return;
+}
+
+// Start or restart a timer that runs the callback after the given number of
+// milliseconds. The callback may be 0 for timers that are only polled with
+// timerActive(). Periodic timers restart themselves from their callback.
+void
+timerStart(Timer *timer, uint32_t ms, void (*callback)(void))
+{
+	timerCancel(timer);
+	
+	// A timer always expires in the future, so restarting one from its own
+	// callback can't make timerService() loop forever
+	if (ms == 0)
+	{
+		ms = 1;
+	}
+	timer->expires = clockMillis() + ms;
+	timer->callback = callback;
+	
+	// Times the wheel has already passed go into the next slot it services
+	uint32_t slotTime = timer->expires;
+	if ((int32_t) (slotTime - wheelTime) <= 0)
+	{
+		slotTime = wheelTime + 1;
+	}
+	Timer **head = &slots[slotTime & TIMER_MASK];
+	timer->next = *head;
+	if (timer->next)
+	{
+		timer->next->link = &timer->next;
+	}
+	timer->link = head;
+	*head = timer;
+	return;
+}
+
+// Stop a timer without running its callback, does nothing if it is idle
+void
+timerCancel(Timer *timer)
+{
+	if (!timer->link)
+	{
+		return;
+	}
+	*timer->link = timer->next;
+	if (timer->next)
+	{
+		timer->next->link = timer->link;
+	}
+	timer->link = 0;
+	return;
+}
+
+// Check if a timer is still waiting to expire
+uint8_t
+timerActive(Timer *timer)
+{
+	return timer->link != 0;
+}
+
+// Run the callbacks of all expired timers. Steps the wheel one millisecond at
+// a time up to the current time, visiting each slot at most once if the main
+// loop has fallen a whole turn behind.
+void
+timerService(void)
+{
+	uint32_t now = clockMillis();
+	uint32_t steps = now - wheelTime;
+	if (steps > TIMER_SLOTS)
+	{
+		steps = TIMER_SLOTS;
+	}
+	
+	while (steps > 0)
+	{
+		uint32_t slotTime = now - steps + 1;
+		steps -= 1;
+		
+		// Rescan after every callback since it may start or cancel timers in
+		// this same slot
+		uint8_t fired = 1;
+		while (fired)
+		{
+			fired = 0;
+			for (Timer *timer = slots[slotTime & TIMER_MASK]; timer; timer = timer->next)
+			{
+				if ((int32_t) (timer->expires - slotTime) <= 0)
+				{
+					timerCancel(timer);
+					if (timer->callback)
+					{
+						timer->callback();
+					}
+					fired = 1;
+					break;
+				}
+			}
+		}
+	}
+	wheelTime = now;
+	return;
+}
@@ -0,0 +1,32 @@
+/*
+ * timer.h
+ *
+ * Software timers on a hashed timer wheel driven by the millisecond system
+ * clock. Timers live in the caller's memory and are linked into one of
+ * TIMER_SLOTS lists by their expiry time, so starting and cancelling one is
+ * O(1) and servicing a millisecond only looks at the timers hashed to it.
+ * Callbacks run from timerService() in the main loop, not from an ISR.
+ */ 
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_SLOTS 32	// Wheel size, must be a power of two
+
+typedef struct Timer
+{
+	struct Timer *next;
+	struct Timer **link;	// Pointer that points to this timer, 0 if idle
+	uint32_t expires;
+	void (*callback)(void);
+} Timer;
+
+void timerInit(void);
+void timerStart(Timer *timer, uint32_t ms, void (*callback)(void));
+void timerCancel(Timer *timer);
+uint8_t timerActive(Timer *timer);
+void timerService(void);
+
+#endif
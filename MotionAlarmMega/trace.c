@@ -0,0 +1,107 @@
+/*
+ * trace.c
+ *
+ * Drains the trace buffer over the debug port.
+ */ 
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "clock.h"
+#include "trace.h"
+
+#define TRACE_HEADER 9	// Sync, time, count and dropped count
+
+struct traceRecord traceBuffer[TRACE_SIZE];
+volatile uint8_t traceHead = 0;
+volatile uint8_t traceTail = 0;
+volatile uint16_t traceDropped = 0;
+
+static uint8_t frame[TRACE_HEADER + TRACE_FRAME * sizeof(struct traceRecord) + 1];
+static uint8_t frameLength = 0;
+static uint8_t frameSent = 0;
+
+// Move up to TRACE_FRAME records from the buffer into a new frame. Only
+// traceEvent() writes records and only at the head, so the ones between the
+// tail and the head can be copied with interrupts on.
+static void
+frameBuild(void)
+{
+	uint8_t head;
+	uint16_t dropped;
+	uint32_t now;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		head = traceHead;
+		dropped = traceDropped;
+		traceDropped = 0;
+		now = clockMilliseconds;
+	}
+	
+	uint8_t tail = traceTail;
+	uint8_t count = 0;
+	uint8_t *out = frame + TRACE_HEADER;
+	while (tail != head && count < TRACE_FRAME)
+	{
+		const uint8_t *record = (const uint8_t *) &traceBuffer[tail];
+		for (uint8_t i = 0; i < sizeof(struct traceRecord); i++)
+		{
+			*out++ = record[i];
+		}
+		tail = (tail + 1) & (TRACE_SIZE - 1);
+		count += 1;
+	}
+	traceTail = tail;
+	
+	frame[0] = TRACE_SYNC1;
+	frame[1] = TRACE_SYNC2;
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		frame[2 + i] = (uint8_t) (now >> (8 * i));
+	}
+	frame[6] = count;
+	frame[7] = (uint8_t) dropped;
+	frame[8] = (uint8_t) (dropped >> 8);
+	
+	uint8_t check = 0;
+	for (uint8_t *byte = frame + 2; byte < out; byte++)
+	{
+		check ^= *byte;
+	}
+	*out++ = check;
+	frameLength = out - frame;
+	frameSent = 0;
+	return;
+}
+
+// Send as much of the trace as the transmitter takes without waiting. Call
+// regularly from the main loop.
+void
+traceService(void)
+{
+	if (frameSent == frameLength)
+	{
+		if (traceHead == traceTail && traceDropped == 0)
+		{
+			return;
+		}
+		frameBuild();
+	}
+	while (frameSent < frameLength && (UCSR0A & (1 << UDRE0)))
+	{
+		UDR0 = frame[frameSent++];
+	}
+	return;
+}
+
+// Finish sending the current frame, so text written to the debug port next
+// doesn't end up inside it
+void
+traceFlush(void)
+{
+	while (frameSent < frameLength)
+	{
+		while (!(UCSR0A & (1 << UDRE0))) {}
+		UDR0 = frame[frameSent++];
+	}
+	return;
+}
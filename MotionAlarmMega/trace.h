@@ -0,0 +1,118 @@
+/*
+ * trace.h
+ *
+ * Binary event trace. traceEvent() stores a six byte record with the time,
+ * an event ID and a 16 bit argument in a RAM ring buffer and is cheap
+ * enough for ISRs and polling loops. traceService() drains the buffer over
+ * the debug port (USART0) a byte at a time whenever the transmitter is
+ * free, in frames that tools/trace_decode.py picks out of the text output.
+ *
+ * Frame: TRACE_SYNC1 TRACE_SYNC2, the 32 bit millisecond time when the
+ * frame started, the record count, the 16 bit count of records dropped
+ * because the buffer was full, the records and an xor of all bytes after
+ * the sync. Numbers are little endian. The millisecond field of a record
+ * holds the low 16 bits of the time, the decoder extends it from the frame
+ * time.
+ *
+ * With TRACE_RECORD the trace becomes a recording of the inputs for
+ * tools/replay.py: only the events in TRACE_RECORDED are kept, so the port
+ * keeps up, and the keypad is scanned on every poll so every press and
+ * release is in it.
+ */ 
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "clock.h"
+#ifdef __AVR__
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#endif
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1	// 0 compiles every traceEvent() out
+#endif
+#ifndef TRACE_RECORD
+#define TRACE_RECORD 0	// 1: record the inputs for replay
+#endif
+
+#define TRACE_SIZE 64	// Records in the buffer, a power of two up to 256
+#define TRACE_FRAME 16	// Most records sent in one frame
+#define TRACE_SYNC1 0xA5
+#define TRACE_SYNC2 0x5A
+
+// Events, keep tools/trace_decode.py in step
+#define TRACE_STATE 1	// Main state entered, argument is the state
+#define TRACE_KEY 2	// Key taken from the keypad, argument is the key
+#define TRACE_ECHO 3	// Echo received, argument is its width in timer 4 ticks
+#define TRACE_ECHO_LOST 4	// Echo edge missed, argument is the level waited for
+#define TRACE_TX 5	// Byte sent to the atmega328p
+#define TRACE_RX 6	// Byte received from the atmega328p
+#define TRACE_FLUSH 7	// Screen delta sent, argument is its length in bytes
+#define TRACE_ENTRY 8	// Password entry finished, argument is the result
+#define TRACE_RTT 9	// Heartbeat answered, argument is the round trip in 16 us
+#define TRACE_KEYSCAN 10	// Keypad scan changed, argument is the key or 'z' when released
+
+// Events kept in a recording, the inputs and the outputs they are judged by.
+// TRACE_KEY starts the key to LCD latency of tools/replay.py.
+#define TRACE_RECORDED ((1UL << TRACE_STATE) | (1UL << TRACE_KEY) \
+	| (1UL << TRACE_ECHO) | (1UL << TRACE_ECHO_LOST) | (1UL << TRACE_TX) \
+	| (1UL << TRACE_RX) | (1UL << TRACE_KEYSCAN))
+
+struct traceRecord {
+	uint16_t ms;
+	uint8_t ticks;	// Timer 5 count within the millisecond, 4 us each
+	uint8_t event;
+	uint16_t arg;
+};
+
+extern struct traceRecord traceBuffer[TRACE_SIZE];
+extern volatile uint8_t traceHead;
+extern volatile uint8_t traceTail;
+extern volatile uint16_t traceDropped;
+
+#ifdef __AVR__
+// Add a record to the buffer, or count it as dropped if the buffer is full.
+// Interrupts are held off only for the few stores.
+static inline void
+traceEvent(uint8_t event, uint16_t arg)
+{
+#if TRACE_ENABLED
+	// Folds away since the event is always a constant
+	if (TRACE_RECORD && !(TRACE_RECORDED & (1UL << event)))
+	{
+		return;
+	}
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t head = traceHead;
+	uint8_t next = (head + 1) & (TRACE_SIZE - 1);
+	if (next == traceTail)
+	{
+		traceDropped += 1;
+	}
+	else
+	{
+		struct traceRecord *record = &traceBuffer[head];
+		record->ms = (uint16_t) clockMilliseconds;
+		record->ticks = TCNT5L;
+		record->event = event;
+		record->arg = arg;
+		traceHead = next;
+	}
+	SREG = sreg;
+#else
+	(void) event;
+	(void) arg;
+#endif
+}
+#else
+// Host builds write the events out as they happen
+void traceEvent(uint8_t event, uint16_t arg);
+#endif
+
+void traceService(void);
+void traceFlush(void);
+
+#endif
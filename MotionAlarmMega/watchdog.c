@@ -0,0 +1,162 @@
+/*
+ * watchdog.c
+ *
+ * Task deadlines on top of the hardware watchdog.
+ */ 
+
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#include "clock.h"
+#include "watchdog.h"
+
+#define WATCHDOG_MAGIC 0x5744	// Marks a valid record
+
+// Longest time each task may take in ms. The main loop has to cover the
+// 1 s message holds and the password entry EEPROM writes.
+static const uint16_t deadlines[WATCHDOG_TASKS] = {
+	3000,	// WATCHDOG_LOOP
+	250,	// WATCHDOG_TIMERS
+	100,	// WATCHDOG_LINK
+	500,	// WATCHDOG_RANGING, five readings with both echo edges timing out
+	100,	// WATCHDOG_KEYPAD
+};
+
+static const char *taskNames[WATCHDOG_TASKS] = {
+	"main loop", "timers", "link", "ranging", "keypad"
+};
+
+// Survives the watchdog reset, the check byte tells it from RAM garbage
+struct watchdogRecord {
+	uint16_t magic;
+	uint8_t task;
+	uint8_t check;
+	uint32_t uptime;
+};
+static struct watchdogRecord record __attribute__((section(".noinit")));
+static uint8_t resetCause __attribute__((section(".noinit")));
+
+static volatile uint16_t started[WATCHDOG_TASKS];
+static volatile uint8_t running = 0;	// Bit per task inside its work
+static volatile uint8_t supervising = 0;
+
+// Save and clear the reset cause and stop the watchdog before main(). The
+// watchdog stays on after it has reset the board, so this has to be done
+// before anything slow runs.
+void watchdogEarly(void) __attribute__((naked, used, section(".init3")));
+void
+watchdogEarly(void)
+{
+	resetCause = MCUSR;
+	MCUSR = 0;
+	wdt_disable();
+}
+
+// Check the deadlines, called from the clock ISR every millisecond
+void
+watchdogTick(void)
+{
+	if (!supervising || (clockMilliseconds & (WATCHDOG_CHECK - 1)))
+	{
+		return;
+	}
+	uint16_t now = (uint16_t) clockMilliseconds;
+	for (uint8_t task = WATCHDOG_TASKS; task-- > 0;)
+	{
+		uint8_t active = task == WATCHDOG_LOOP || (running & (1 << task));
+		if (active && (uint16_t) (now - started[task]) > deadlines[task])
+		{
+			record.magic = WATCHDOG_MAGIC;
+			record.task = task;
+			record.check = task ^ 0xFF;
+			record.uptime = clockMilliseconds;
+			wdt_enable(WDTO_15MS);
+			while (1) {}
+		}
+	}
+	wdt_reset();
+}
+
+// Turn the hardware watchdog on, after the clock has been started
+void
+watchdogStart(void)
+{
+	watchdogCheckIn();
+	wdt_enable(WATCHDOG_TIMEOUT);
+	supervising = 1;
+	return;
+}
+
+// Mark a main loop iteration
+void
+watchdogCheckIn(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		started[WATCHDOG_LOOP] = (uint16_t) clockMilliseconds;
+	}
+	return;
+}
+
+// Start the deadline of a task
+void
+watchdogBegin(uint8_t task)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		started[task] = (uint16_t) clockMilliseconds;
+		running |= (1 << task);
+	}
+	return;
+}
+
+// The task is done, it has no deadline until it begins again
+void
+watchdogEnd(uint8_t task)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		running &= ~(1 << task);
+	}
+	return;
+}
+
+// Print why the board was reset, then forget the stalled task
+void
+watchdogReport(void (*print)(const char *text))
+{
+	char line[80];
+	// Some bootloaders clear MCUSR before starting the firmware
+	if (resetCause & ((1 << PORF) | (1 << EXTRF) | (1 << BORF) | (1 << WDRF) | (1 << JTRF)))
+	{
+		snprintf(line, sizeof(line), "reset by%s%s%s%s%s\r\n",
+			resetCause & (1 << PORF) ? " power-on" : "",
+			resetCause & (1 << EXTRF) ? " reset pin" : "",
+			resetCause & (1 << BORF) ? " brown-out" : "",
+			resetCause & (1 << WDRF) ? " watchdog" : "",
+			resetCause & (1 << JTRF) ? " jtag" : "");
+		print(line);
+	}
+	else
+	{
+		print("reset cause unknown\r\n");
+	}
+	
+	if (resetCause & (1 << WDRF))
+	{
+		if (record.magic == WATCHDOG_MAGIC && (record.check ^ record.task) == 0xFF
+			&& record.task < WATCHDOG_TASKS)
+		{
+			snprintf(line, sizeof(line), "%s stalled at %lu ms\r\n",
+				taskNames[record.task], record.uptime);
+			print(line);
+		}
+		else
+		{
+			print("no task stalled, interrupts held off\r\n");
+		}
+	}
+	record.magic = 0;
+	return;
+}
@@ -0,0 +1,42 @@
+/*
+ * watchdog.h
+ *
+ * Watchdog supervision of the main loop and the subsystems it runs. A
+ * subsystem calls watchdogBegin() and watchdogEnd() around its work and
+ * the main loop calls watchdogCheckIn() every iteration. The clock ISR
+ * checks the deadlines every WATCHDOG_CHECK ms and only resets the
+ * hardware watchdog while all of them are met. On a miss the stalled task
+ * is saved in .noinit RAM and the board is reset right away, if the ISR
+ * itself is held off the hardware watchdog resets the board after
+ * WATCHDOG_TIMEOUT without a task.
+ *
+ * watchdogReport() prints the cause of the last reset from MCUSR and the
+ * task that stalled, if that was the cause.
+ */ 
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdint.h>
+
+#define WATCHDOG_TIMEOUT WDTO_250MS	// Hardware watchdog period, from avr/wdt.h
+#define WATCHDOG_CHECK 16	// Time between deadline checks in ms, a power of two
+
+// Tasks, deadlines are in watchdog.c. When several are late the one with
+// the highest number is blamed, so the inner ones come last.
+#define WATCHDOG_LOOP 0	// Main loop iteration, including waitMs() holds
+#define WATCHDOG_TIMERS 1	// Software timers and their callbacks
+#define WATCHDOG_LINK 2	// Bytes received from the atmega328p
+#define WATCHDOG_RANGING 3	// getDistance()
+#define WATCHDOG_KEYPAD 4	// Keypad scan
+#define WATCHDOG_TASKS 5
+#define WATCHDOG_NONE 0xFF
+
+void watchdogTick(void);
+void watchdogStart(void);
+void watchdogCheckIn(void);
+void watchdogBegin(uint8_t task);
+void watchdogEnd(uint8_t task);
+void watchdogReport(void (*print)(const char *text));
+
+#endif
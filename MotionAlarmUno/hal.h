@@ -0,0 +1,106 @@
+/*
+ * hal.h
+ *
+ * Hardware main.c touches besides the LCD: the USART to the atmega2560,
+ * the timer 1 clock and the millisecond delay. On the AVR every call is
+ * an inline register access, so nothing is added to the firmware. Other
+ * compilers only get the prototypes, the host build supplies them with
+ * fake hardware behind (see host/uno), together with a fake lcd.c.
+ */ 
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+#ifdef __AVR__
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "link.h"
+
+// _delay_ms() needs a constant, so this can't be a function
+#define halDelayMs(ms) _delay_ms(ms)
+
+// USART0 to the atmega2560, 8 data bits, 1 stop bit, no parity. Received
+// bytes are queued by the receive interrupt (link.c). It is the only
+// interrupt of the board, so interrupts are turned on here.
+static inline void
+halLinkInit(uint16_t ubrr, uint8_t doubleSpeed)
+{
+	UBRR0H = (uint8_t) (ubrr >> 8);
+	UBRR0L = (uint8_t) ubrr;
+	UCSR0A = doubleSpeed ? (1 << U2X0) : 0;
+	UCSR0B = (1 << TXEN0) | (1 << RXEN0) | (1 << RXCIE0);
+	UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+	sei();
+}
+
+static inline uint8_t
+halLinkWritable(void)
+{
+	return (UCSR0A & (1 << UDRE0)) != 0;
+}
+
+static inline void
+halLinkWrite(uint8_t data)
+{
+	UDR0 = data;
+}
+
+static inline uint8_t
+halLinkReadable(void)
+{
+	return linkQueueCount(&linkReceived) != 0;
+}
+
+static inline uint8_t
+halLinkRead(void)
+{
+	uint8_t data = 0;
+	linkQueuePop(&linkReceived, &data);
+	return data;
+}
+
+// Timer 1 free running with a prescaler of 1024, 64 us ticks
+static inline void
+halClockInit(void)
+{
+	TCCR1A = 0;
+	TCCR1B = (1 << CS12) | (1 << CS10);
+}
+
+static inline uint16_t
+halClockCount(void)
+{
+	return TCNT1;
+}
+
+// Check for an overflow since the last call and clear it
+static inline uint8_t
+halClockOverflowed(void)
+{
+	if (TIFR1 & (1 << TOV1))
+	{
+		TIFR1 = (1 << TOV1);
+		return 1;
+	}
+	return 0;
+}
+
+#else
+
+void halDelayMs(uint16_t ms);
+void halLinkInit(uint16_t ubrr, uint8_t doubleSpeed);
+uint8_t halLinkWritable(void);
+void halLinkWrite(uint8_t data);
+uint8_t halLinkReadable(void);
+uint8_t halLinkRead(void);
+void halClockInit(void);
+uint16_t halClockCount(void);
+uint8_t halClockOverflowed(void);
+
+#endif
+
+#endif
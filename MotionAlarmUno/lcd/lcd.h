@@ -292,6 +292,18 @@
 extern void lcd_init(uint8_t dispAttr);
 
 
+/**
+ @brief    Perform the next step of the display initialization without blocking
+ 
+ Alternative to lcd_init() for callers that have other work to do during the 
+ power-on delays. Call repeatedly, waiting at least the returned time between 
+ calls, until it returns 0. Only available in 4-bit IO port mode.
+ @param    dispAttr same as lcd_init()
+ @return   minimum time in micro seconds before the next call, 0 when done
+*/
+extern uint16_t lcd_init_step(uint8_t dispAttr);
+
+
 /**
  @brief    Clear display and set cursor to home position
  @return   none
@@ -0,0 +1,20 @@
+/*
+ * link.c
+ *
+ * USART0 receive interrupt of the link to the atmega2560, the only
+ * interrupt of this board.
+ */ 
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "link.h"
+
+struct linkQueue linkReceived;
+
+// A byte that finds the queue full is dropped, as the hardware buffer
+// would have done
+ISR(USART_RX_vect)
+{
+	uint8_t data = UDR0;
+	linkQueuePush(&linkReceived, data);
+}
@@ -0,0 +1,22 @@
+/*
+ * link.h
+ *
+ * Receive queue of the link to the atmega2560. The USART0 receive
+ * interrupt pushes every byte, halLinkRead() pops them, so a screen delta
+ * that arrives while the LCD is being written waits in RAM instead of
+ * overrunning the two byte hardware buffer.
+ */ 
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+#include "../common/spsc.h"
+
+#define LINK_QUEUE_SIZE 64	// Bytes, a power of two up to 256
+
+SPSC_QUEUE(linkQueue, uint8_t, LINK_QUEUE_SIZE)
+
+extern struct linkQueue linkReceived;
+
+#endif
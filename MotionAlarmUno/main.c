@@ -5,15 +5,40 @@
  */ 
 
 #define F_CPU 16000000UL
-#define FOSC 16000000UL
-#define BAUD 115200
-#define MYUBRR (FOSC/16/BAUD-1)
+#define LINK_BAUD 500000	// Link baud rate, 250000 and 1000000 also divide exactly
+#define HEARTBEAT_MISSED_LIMIT 3	// Seconds without a heartbeat before reconnecting
+#define REMOTE_DISPLAY 0	// 1: only apply screen deltas drawn by the atmega2560
+#define CONNECT_RETRY 3125	// Time between boot handshake attempts in 64 us ticks (200 ms)
 
-#include <avr/io.h>
-#include <util/delay.h>
+#include "hal.h"
 #include "lcd/lcd.h" // lcd header file made by Peter Fleury
+#include "../common/baud.h"
+#include "../common/stack.h"
+
+#if BAUD_ERROR(LINK_BAUD) > BAUD_TOL
+#error "LINK_BAUD can't be generated accurately from F_CPU"
+#endif
+
+// Longest entry shown, PIN_MAX_DIGITS of the atmega2560. The countdown
+// takes the last three columns of the input line.
+#define PIN_MAX_DIGITS 8
+#if PIN_MAX_DIGITS > LCD_DISP_LENGTH - 3
+#error "PIN_MAX_DIGITS runs into the countdown"
+#endif
 
 // System states and communication constants
+#define CONNECT 111
+#define MEMORY 235
+#define LOCKOUT 236
+#define PINREJECTED 237
+#define SLOTCLEARED 238
+#define SLOTINPUT 239
+#define ENTRYCANCEL 240
+#define COUNTDOWN 241
+#define SCREEN 242
+#define LINKSTATS 243
+#define HEARTBEAT 244
+#define TELEMETRY 245
 #define ARMED 246
 #define MOVEMENT 247
 #define DISARMED 248
@@ -25,18 +50,44 @@
 #define WRONGPASS 254
 #define TIMEOUT 255
 
-void 
-initSerial() 
+// Highest payload value, see main.c in MotionAlarmMega
+#define TELEMETRY_MAX (MEMORY - 1)
+
+// Screen delta frames, see screen.h in MotionAlarmMega
+#define SCREEN_SIZE (LCD_DISP_LENGTH * LCD_LINES)
+#define SCREEN_END 127
+
+uint8_t heartbeatsMissed = 0;
+uint8_t lockoutShown = 0;
+uint16_t clockOverflows = 0;
+uint16_t stackFree = 0xFFFF;
+
+// Start timer 1 as a free running clock with a prescaler of 1024 (64 us ticks)
+void
+initTimer()
 {
-	// Set baud rate
-	UBRR0H = (uint8_t) (MYUBRR >> 8);
-	UBRR0L = (uint8_t) MYUBRR;
+	halClockInit();
+	return;
+}
 
-	// Enable transmitter and receiver
-	UCSR0B = (1 << TXEN0) | (1 << RXEN0);
+// Get the time since initTimer() in 64 us ticks. Overflows are counted from
+// the overflow flag, so this has to be called at least every 4 seconds.
+uint32_t
+readClock()
+{
+	uint16_t ticks = halClockCount();
+	if (halClockOverflowed())
+	{
+		clockOverflows += 1;
+		ticks = halClockCount();
+	}
+	return ((uint32_t) clockOverflows << 16) | ticks;
+}
 
-	// Set frame format: 8 data bits, 1 stop bit, no parity
-	UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+void 
+initSerial() 
+{
+	halLinkInit(BAUD_UBRR(LINK_BAUD), BAUD_USE_2X(LINK_BAUD));
 	return;
 }
 
@@ -45,29 +96,82 @@ void
 sendData(uint8_t data)
 {
 	// Wait for empty transmit buffer
-	while (!(UCSR0A & (1 << UDRE0))) {}
+	while (!halLinkWritable()) {}
 
 	// Send the data
-	UDR0 = data;
+	halLinkWrite(data);
 	return;
 }
 
-// Receive a byte from the atmega2560, waiting for the message as many
+// Report the bytes of stack never used to the atmega2560, in two 7 bit
+// halves so they can't be mistaken for a code
+void
+sendMemory()
+{
+	stackFree = stackUnused(stackFree);
+	sendData(MEMORY);
+	sendData(stackFree & 0x7F);
+	sendData((stackFree >> 7) & 0x7F);
+	return;
+}
+
+// Receive a byte from the atmega2560 as it comes, waiting for it as many
 // milliseconds as the parameter "timeout" determines
-unsigned char 
-receiveData(uint16_t timeout) 
+uint8_t
+receiveByte(uint16_t timeout)
 {
 	uint16_t timeElapsed = 0;
-	while (!(UCSR0A & (1 << RXC0)))
+	while (!halLinkReadable())
 	{
 		timeElapsed += 1;
-		_delay_ms(1);
+		halDelayMs(1);
 		if (timeElapsed > timeout)
 		{
 			return TIMEOUT;
 		}
 	}
-	return UDR0;
+	return halLinkRead();
+}
+
+// Receive a byte from the atmega2560, waiting for the message as many
+// milliseconds as the parameter "timeout" determines. Heartbeats and memory
+// requests are answered immediately and never returned to the caller.
+unsigned char 
+receiveData(uint16_t timeout) 
+{
+	uint16_t timeElapsed = 0;
+	while (1)
+	{
+		while (!halLinkReadable())
+		{
+			timeElapsed += 1;
+			halDelayMs(1);
+			if (timeElapsed > timeout)
+			{
+				return TIMEOUT;
+			}
+		}
+		uint8_t data = halLinkRead();
+		if (data == MEMORY)
+		{
+			sendMemory();
+			continue;
+		}
+		if (data != HEARTBEAT)
+		{
+			return data;
+		}
+		
+		// The sequence number follows right after the heartbeat. It is
+		// taken as it comes, a run of heartbeats mustn't nest calls.
+		uint8_t sequence = receiveByte(2);
+		if (sequence < 128)
+		{
+			sendData(HEARTBEAT);
+			sendData(sequence);
+			heartbeatsMissed = 0;
+		}
+	}
 }
 
 // Try to connect to the atmega2560
@@ -79,9 +183,9 @@ attemptConnection()
 	// Send value 111 up to 50 times, while listening for echo each time
 	while (attempts < 50)
 	{
-		sendData(111);
+		sendData(CONNECT);
 		uint8_t response = receiveData(200);
-		if (response == 111)
+		if (response == CONNECT)
 		{
 			// If we get 111 in response, the connection is established
 			return 1;
@@ -91,42 +195,174 @@ attemptConnection()
 	return 0;
 }
 
-// Update the LCD based on the inputs the user gives
+// Write value as a right-aligned decimal number of the given width
 void
-handleKeypadInput()
+formatNumber(char *buffer, uint16_t value, uint8_t width)
 {
-	lcd_clrscr();
-	lcd_puts("Input password:");
-	lcd_gotoxy(0,1);
-	
-	uint8_t inputsGiven = 0;
-	char input = 0;
-	
-	while (input != '#')
+	for (uint8_t i = width; i > 0; i--)
+	{
+		buffer[i - 1] = (value || i == width) ? '0' + value % 10 : ' ';
+		value /= 10;
+	}
+	return;
+}
+
+// Receive a telemetry message and show it on the second line of the LCD.
+// The payload follows the TELEMETRY byte immediately, so short timeouts keep
+// a lost byte from delaying the next state update.
+void
+showTelemetry()
+{
+	uint8_t payload[3];
+	for (uint8_t i = 0; i < 3; i++)
 	{
-		input = receiveData(1000);
-		// Check if input is a character between 0-9
-		if (input > 47 && input < 58)
+		payload[i] = receiveData(10);
+		// Drop the message if it was cut short
+		if (payload[i] > TELEMETRY_MAX)
 		{
-			lcd_putc(input);
-			inputsGiven += 1;
+			return;
 		}
-		// If # is pressed, erase character
-		else if (input == '*')
+	}
+	
+	// Fixed width fields so the previous values are always overwritten,
+	// e.g. " 42cm  9/s F  0"
+	char line[16] = "   cm   /s F   ";
+	formatNumber(line, payload[0], 3);
+	formatNumber(line + 6, payload[1] > 99 ? 99 : payload[1], 2);
+	formatNumber(line + 12, payload[2], 3);
+	lcd_gotoxy(0, 1);
+	lcd_puts(line);
+	return;
+}
+
+// Write a value in tenths as a four character decimal number, e.g. " 1.2"
+void
+formatTenths(char *buffer, uint8_t value)
+{
+	formatNumber(buffer, value / 10, 2);
+	buffer[2] = '.';
+	buffer[3] = '0' + value % 10;
+	return;
+}
+
+// Receive the link statistics and show them on the second line of the LCD
+void
+showLinkStats()
+{
+	uint8_t payload[3];
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		payload[i] = receiveData(10);
+		if (payload[i] > TELEMETRY_MAX)
 		{
-			inputsGiven -= 1;
-			lcd_gotoxy(inputsGiven, 1);
-			lcd_putc(' ');
-			lcd_gotoxy(inputsGiven, 1);
+			return;
 		}
-		else
+	}
+	
+	// Median and 95th percentile round-trip time and loss percentage,
+	// e.g. " 1.2/ 3.4ms L 0%"
+	char line[17] = "    /    ms L  %";
+	formatTenths(line, payload[0]);
+	formatTenths(line + 5, payload[1]);
+	formatNumber(line + 13, payload[2] > 99 ? 99 : payload[2], 2);
+	lcd_gotoxy(0, 1);
+	lcd_puts(line);
+	return;
+}
+
+// Receive the seconds left before the alarm goes off and show them in the
+// bottom right corner of the LCD
+void
+showCountdown()
+{
+	uint8_t seconds = receiveData(10);
+	if (seconds > TELEMETRY_MAX)
+	{
+		return;
+	}
+	
+	char text[4] = "  s";
+	formatNumber(text, seconds, 2);
+	lcd_gotoxy(LCD_DISP_LENGTH - 3, 1);
+	lcd_puts(text);
+	return;
+}
+
+// Receive the seconds left before the keypad is unlocked and show them. The
+// screen is only cleared for the first one so the countdown in the bottom
+// right corner stays up.
+void
+showLockout()
+{
+	uint8_t seconds = receiveData(10);
+	if (seconds > TELEMETRY_MAX)
+	{
+		return;
+	}
+	
+	if (!lockoutShown)
+	{
+		lcd_clrscr();
+		lcd_puts("Keypad locked");
+		lockoutShown = 1;
+	}
+	char line[14] = "Retry in    s";
+	formatNumber(line + 9, seconds, 3);
+	lcd_gotoxy(0, 1);
+	lcd_puts(line);
+	return;
+}
+
+// Update the LCD based on the inputs the user gives. Entries have up to
+// PIN_MAX_DIGITS digits, as many as the atmega2560 takes, and end with '#'. Changing a
+// code chains several prompts, each one following the '#' of the last, so
+// they are looped over rather than recursed into to keep the stack flat
+// however many the atmega2560 sends.
+void
+handleKeypadInput(uint8_t prompt)
+{
+	char input = prompt;
+	while (input == INPUT || input == SLOTINPUT)
+	{
+		lcd_clrscr();
+		lcd_puts(input == SLOTINPUT ? "Slot number:" : "Input password:");
+		lcd_gotoxy(0,1);
+		
+		uint8_t inputsGiven = 0;
+		input = 0;
+		while (input != '#')
 		{
-			// Ignore other inputs
+			input = receiveData(1000);
+			// Check if input is a character between 0-9
+			if (input > 47 && input < 58 && inputsGiven < PIN_MAX_DIGITS)
+			{
+				lcd_putc(input);
+				inputsGiven += 1;
+			}
+			// If * is pressed, erase character
+			else if (input == '*' && inputsGiven > 0)
+			{
+				inputsGiven -= 1;
+				lcd_gotoxy(inputsGiven, 1);
+				lcd_putc(' ');
+				lcd_gotoxy(inputsGiven, 1);
+			}
+			// Show the countdown and move the cursor back to the input
+			else if (input == COUNTDOWN)
+			{
+				showCountdown();
+				lcd_gotoxy(inputsGiven, 1);
+			}
+			else
+			{
+				// Ignore other inputs
+			}
 		}
+		
+		// Receive result of password input, or the next prompt
+		input = receiveData(5000);
 	}
 	
-	// Receive result of password input and display it
-	input = receiveData(5000);
 	lcd_clrscr();
 	switch (input) 
 	{
@@ -150,6 +386,18 @@ handleKeypadInput()
 			lcd_puts("Alarm timeout");
 			break;
 			
+		case ENTRYCANCEL:
+			lcd_puts("Entry cancelled");
+			break;
+			
+		case SLOTCLEARED:
+			lcd_puts("Code removed");
+			break;
+			
+		case PINREJECTED:
+			lcd_puts("Code rejected");
+			break;
+			
 		default:
 			lcd_puts("input error");
 			lcd_putc(input);
@@ -158,63 +406,216 @@ handleKeypadInput()
 	return;
 }
 
-int
-main(void)
+// Apply a screen delta frame from the atmega2560 to the LCD. Position bytes
+// move the cursor and characters are written from there on, wrapping from
+// the first line to the second. The frame ends at SCREEN_END or at anything
+// out of range.
+void
+applyScreen()
 {
-	// initialize everything and connect to the atmega2560
-	lcd_init(LCD_DISP_ON);
-	initSerial();
-	if (attemptConnection())
+	uint8_t position = SCREEN_SIZE;
+	while (1)
 	{
-		lcd_clrscr();
-		lcd_puts("Connected");
-	} 
-	else
+		uint8_t data = receiveData(10);
+		if (data < SCREEN_SIZE)
+		{
+			position = data;
+			lcd_gotoxy(position % LCD_DISP_LENGTH, position / LCD_DISP_LENGTH);
+		}
+		else if (data >= ' ' && data < SCREEN_END && position < SCREEN_SIZE)
+		{
+			lcd_putc(data);
+			position += 1;
+			if (position == LCD_DISP_LENGTH)
+			{
+				lcd_gotoxy(0, 1);
+			}
+		}
+		else
+		{
+			return;
+		}
+	}
+}
+
+// Update the LCD based on a message from the atmega2560
+void
+handleMessage(uint8_t newState)
+{
+	// Anything but the lockout and countdown updates replaces the lockout
+	if (newState != LOCKOUT && newState != COUNTDOWN && newState != TIMEOUT)
 	{
-		lcd_clrscr();
-		lcd_puts("Not connected");
-		return 0;
+		lockoutShown = 0;
 	}
-	
-	while (1) {
-		uint8_t newState = receiveData(1000);
+	switch (newState) 
+	{
+#if REMOTE_DISPLAY
+		case SCREEN:
+			applyScreen();
+			break;
+			
+		case CONNECT:
+			// Late handshake reply, the screen follows it
+			break;
+#else
+		case ARMED:
+			lcd_clrscr();
+			lcd_puts("Alarm armed");
+			break;
 		
-		switch (newState) 
-		{
-			case ARMED:
-				lcd_clrscr();
-				lcd_puts("Alarm armed");
-				break;
+		case MOVEMENT:
+			lcd_clrscr();
+			lcd_puts("Motion detected");
+			break;
+		
+		case DISARMED:
+			lcd_clrscr();
+			lcd_puts("Alarm disarmed");
+			break;
 			
-			case MOVEMENT:
-				lcd_clrscr();
-				lcd_puts("Motion detected");
-				break;
+		case ALARMTIMEOUT:
+			lcd_clrscr();
+			lcd_puts("Alarm timeout");
+			break;
+			
+		case INPUT:
+			handleKeypadInput(INPUT);
+			break;
 			
-			case DISARMED:
+		case TELEMETRY:
+			showTelemetry();
+			break;
+			
+		case COUNTDOWN:
+			showCountdown();
+			break;
+
+		case LINKSTATS:
+			showLinkStats();
+			break;
+			
+		case LOCKOUT:
+			showLockout();
+			break;
+#endif
+
+		case TIMEOUT:
+			// Redo the handshake if the heartbeat has stopped, otherwise
+			// go back to listening
+			heartbeatsMissed += 1;
+			if (heartbeatsMissed >= HEARTBEAT_MISSED_LIMIT)
+			{
 				lcd_clrscr();
-				lcd_puts("Alarm disarmed");
-				break;
-				
-			case ALARMTIMEOUT:
+				while (!attemptConnection())
+				{
+					lcd_clrscr();
+				}
+				heartbeatsMissed = 0;
 				lcd_clrscr();
-				lcd_puts("Alarm timeout");
-				break;
-				
-			case INPUT:
-				handleKeypadInput();
-				break;
-	
-			case TIMEOUT:
-				// Ignore timeout signal and go back to listening
-				break;
+				lcd_puts("Reconnected");
+			}
+			break;
+
+		default:
+			lcd_clrscr();
+			lcd_puts("Unknown data: ");
+			lcd_putc(newState);
+			break;
+	}
+	return;
+}
+
+// Show the time it took to get the LCD and the connection ready on the
+// second line of the LCD
+void
+showReadyTime(uint32_t ticks)
+{
+	char line[17] = "Ready in      ms";
+	formatNumber(line + 9, ticks * 64 / 1000, 5);
+	lcd_gotoxy(0, 1);
+	lcd_puts(line);
+	return;
+}
+
+int
+main(void)
+{
+	// Initialize the LCD and connect to the atmega2560 at the same time. The
+	// LCD initialization is stepped during the handshake instead of blocking
+	// it with its power-on delays.
+	initTimer();
+	initSerial();
+	uint8_t lcdReady = 0;
+	uint8_t connected = 0;
+#if !REMOTE_DISPLAY
+	uint8_t pendingState = TIMEOUT;
+#endif
+	uint32_t lcdStepAt = 0;
+	uint32_t lcdWait = 0;
+	uint32_t connectSentAt = 0;
+	uint8_t connectSent = 0;
 	
-			default:
-				lcd_clrscr();
-				lcd_puts("Unknown data: ");
-				lcd_putc(newState);
-				break;
+	while (!lcdReady || !connected)
+	{
+		uint32_t now = readClock();
+		if (!lcdReady && now - lcdStepAt >= lcdWait)
+		{
+			uint16_t delay = lcd_init_step(LCD_DISP_ON);
+			lcdStepAt = readClock();
+			// Round up and add a tick since the first one may be partial
+			lcdWait = delay / 64 + 2;
+			if (delay == 0)
+			{
+				lcdReady = 1;
+				lcd_puts("Connecting...");
+			}
+		}
+		
+		if (!connected && (!connectSent || now - connectSentAt >= CONNECT_RETRY))
+		{
+			sendData(CONNECT);
+			connectSentAt = now;
+			connectSent = 1;
+		}
+		
+		if (halLinkReadable())
+		{
+			uint8_t data = receiveData(0);
+			if (data == CONNECT)
+			{
+				connected = 1;
+			}
+#if !REMOTE_DISPLAY
+			// Keep the latest screen to show once the LCD is ready
+			else if (connected && data >= ARMED && data <= TRIGGERED)
+			{
+				pendingState = data;
+			}
+#endif
 		}
 	}
+	
+#if REMOTE_DISPLAY
+	// Screen deltas received before the LCD was ready were dropped, so
+	// redo the handshake to have the atmega2560 repaint everything
+	lcd_clrscr();
+	sendData(CONNECT);
+#else
+	uint32_t readyTicks = readClock();
+	if (pendingState != TIMEOUT)
+	{
+		handleMessage(pendingState);
+	}
+	else
+	{
+		lcd_clrscr();
+		lcd_puts("Connected");
+	}
+	showReadyTime(readyTicks);
+#endif
+	
+	while (1) {
+		handleMessage(receiveData(1000));
+	}
 	return 0;
 }
\ No newline at end of file
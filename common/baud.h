@@ -0,0 +1,52 @@
+/*
+ * baud.h
+ *
+ * Compile-time USART baud rate divisors shared by both boards. For a given
+ * rate the divisor is calculated for both normal and double speed (U2X)
+ * mode and the one with the lower error is used, preferring normal mode on
+ * a tie since it samples each bit more times. All macros are integer
+ * constant expressions, so they can also be checked with #if:
+ *
+ *     #if BAUD_ERROR(LINK_BAUD) > BAUD_TOL
+ *     #error "LINK_BAUD can't be generated from F_CPU"
+ *     #endif
+ *
+ * With a 16 MHz clock 250000, 500000 and 1000000 baud divide exactly,
+ * 115200 baud has a 2.1 % error in U2X mode and 3.5 % in normal mode.
+ */ 
+
+#ifndef BAUD_H
+#define BAUD_H
+
+#ifndef F_CPU
+#error "F_CPU must be defined before including baud.h"
+#endif
+
+#ifndef BAUD_TOL
+#define BAUD_TOL 25	// Maximum allowed baud rate error in 0.1 %
+#endif
+
+// Rounded UBRR values for normal (16 samples per bit) and U2X (8) mode
+#define BAUD_UBRR_NORMAL(baud) ((F_CPU + 8UL * (baud)) / (16UL * (baud)) - 1)
+#define BAUD_UBRR_2X(baud) ((F_CPU + 4UL * (baud)) / (8UL * (baud)) - 1)
+
+// Rates actually generated by the rounded UBRR values
+#define BAUD_ACTUAL_NORMAL(baud) (F_CPU / (16UL * (BAUD_UBRR_NORMAL(baud) + 1)))
+#define BAUD_ACTUAL_2X(baud) (F_CPU / (8UL * (BAUD_UBRR_2X(baud) + 1)))
+
+// Absolute difference between the generated and wanted rate in 0.1 %
+#define BAUD_DIFF(actual, baud) \
+	((actual) > (baud) ? (actual) - (baud) : (baud) - (actual))
+#define BAUD_ERROR_NORMAL(baud) \
+	(BAUD_DIFF(BAUD_ACTUAL_NORMAL(baud), (baud)) * 1000UL / (baud))
+#define BAUD_ERROR_2X(baud) \
+	(BAUD_DIFF(BAUD_ACTUAL_2X(baud), (baud)) * 1000UL / (baud))
+
+// Mode, UBRR value and error of the best setting for a rate
+#define BAUD_USE_2X(baud) (BAUD_ERROR_2X(baud) < BAUD_ERROR_NORMAL(baud))
+#define BAUD_UBRR(baud) \
+	(BAUD_USE_2X(baud) ? BAUD_UBRR_2X(baud) : BAUD_UBRR_NORMAL(baud))
+#define BAUD_ERROR(baud) \
+	(BAUD_USE_2X(baud) ? BAUD_ERROR_2X(baud) : BAUD_ERROR_NORMAL(baud))
+
+#endif
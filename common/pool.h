@@ -0,0 +1,96 @@
+/*
+ * pool.h
+ *
+ * Fixed block allocator for both boards, in place of malloc(). POOL(name,
+ * type, count) declares struct name with room for count blocks of the
+ * type and the functions for it:
+ *
+ *     name##Alloc(pool)          A block, 0 if all are in use
+ *     name##Free(pool, block)    Give a block back
+ *     name##Left(pool)           Blocks not in use, to wait for one
+ *
+ * Both are O(1) and can be called from ISRs and the main code alike, they
+ * hold interrupts off for a few stores. The pool keeps its own statistics
+ * in used, peak and failed. Free blocks are chained through their first
+ * byte and blocks that were never handed out are taken in order, so a
+ * zeroed pool, e.g. one in .bss, has every block free.
+ *
+ * Host builds run single threaded and don't lock.
+ */ 
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+
+#ifdef __AVR__
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#define poolLock() uint8_t poolSreg = SREG; cli()
+#define poolUnlock() SREG = poolSreg
+#else
+#define poolLock() do {} while (0)
+#define poolUnlock() do {} while (0)
+#endif
+
+#define POOL(name, type, count) \
+	_Static_assert((count) >= 1 && (count) <= 255, \
+		#name " count must be 1 to 255"); \
+	\
+	struct name { \
+		uint8_t free;	/* First free block + 1, 0 if none */ \
+		uint8_t fresh;	/* Blocks never handed out start here */ \
+		uint8_t used; \
+		uint8_t peak; \
+		uint16_t failed; \
+		type blocks[count]; \
+	}; \
+	\
+	static inline type * \
+	name##Alloc(struct name *pool) \
+	{ \
+		type *block = 0; \
+		poolLock(); \
+		if (pool->free != 0) \
+		{ \
+			block = &pool->blocks[pool->free - 1]; \
+			pool->free = *(uint8_t *) block; \
+		} \
+		else if (pool->fresh < (count)) \
+		{ \
+			block = &pool->blocks[pool->fresh]; \
+			pool->fresh += 1; \
+		} \
+		if (block) \
+		{ \
+			pool->used += 1; \
+			if (pool->used > pool->peak) \
+			{ \
+				pool->peak = pool->used; \
+			} \
+		} \
+		else \
+		{ \
+			pool->failed += 1; \
+		} \
+		poolUnlock(); \
+		return block; \
+	} \
+	\
+	static inline void \
+	name##Free(struct name *pool, type *block) \
+	{ \
+		poolLock(); \
+		*(uint8_t *) block = pool->free; \
+		pool->free = (uint8_t) (block - pool->blocks) + 1; \
+		pool->used -= 1; \
+		poolUnlock(); \
+	} \
+	\
+	static inline uint8_t \
+	name##Left(struct name *pool) \
+	{ \
+		return (count) - *(volatile uint8_t *) &pool->used; \
+	}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * spsc.h
+ *
+ * Ring buffer queue for one producer and one consumer, e.g. an ISR and the
+ * main loop, for both boards. SPSC_QUEUE(name, type, size) declares
+ * struct name and the functions for it:
+ *
+ *     name##Push(queue, item)    Producer, 0 if the queue was full
+ *     name##Pop(queue, &item)    Consumer, 0 if the queue was empty
+ *     name##Count(queue)         Either side, items waiting
+ *
+ * The size is a power of two up to 256 and one slot is always left free,
+ * so a queue holds size - 1 items. Only the producer writes the head and
+ * only the consumer the tail, and both are single bytes, which the AVR
+ * loads and stores in one instruction. Neither side has to turn
+ * interrupts off, the item is stored before the head that publishes it
+ * and read before the tail that frees its slot. A zeroed queue, e.g. one
+ * in .bss, is empty.
+ */ 
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdint.h>
+
+#ifdef __AVR__
+// The accesses are atomic already, the compiler only has to keep the items
+// on their side of them
+#define spscLoad(index) \
+	({ uint8_t value = (index); __asm__ __volatile__("" ::: "memory"); value; })
+#define spscStore(index, value) \
+	do { __asm__ __volatile__("" ::: "memory"); (index) = (value); } while (0)
+#else
+// Host builds run the two sides on threads of a machine that reorders
+#define spscLoad(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define spscStore(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+#endif
+
+#define SPSC_QUEUE(name, type, size) \
+	_Static_assert((size) >= 2 && (size) <= 256 && ((size) & ((size) - 1)) == 0, \
+		#name " size must be a power of two up to 256"); \
+	\
+	struct name { \
+		volatile uint8_t head; \
+		volatile uint8_t tail; \
+		type items[size]; \
+	}; \
+	\
+	static inline uint8_t \
+	name##Push(struct name *queue, type item) \
+	{ \
+		uint8_t head = queue->head; \
+		uint8_t next = (head + 1) & ((size) - 1); \
+		if (next == spscLoad(queue->tail)) \
+		{ \
+			return 0; \
+		} \
+		queue->items[head] = item; \
+		spscStore(queue->head, next); \
+		return 1; \
+	} \
+	\
+	static inline uint8_t \
+	name##Pop(struct name *queue, type *item) \
+	{ \
+		uint8_t tail = queue->tail; \
+		if (tail == spscLoad(queue->head)) \
+		{ \
+			return 0; \
+		} \
+		*item = queue->items[tail]; \
+		spscStore(queue->tail, (tail + 1) & ((size) - 1)); \
+		return 1; \
+	} \
+	\
+	static inline uint8_t \
+	name##Count(struct name *queue) \
+	{ \
+		return (spscLoad(queue->head) - spscLoad(queue->tail)) & ((size) - 1); \
+	}
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * stack.h
+ *
+ * Stack high-water mark for both boards. Before anything else runs, the
+ * RAM between the end of .bss and the top of the stack is filled with
+ * STACK_PAINT. The stack grows down into that region and the heap isn't
+ * used, so the painted bytes left right above .bss are RAM that has never
+ * been touched:
+ *
+ *     | .data | .bss | never used | deepest stack | ... | RAMEND |
+ *
+ * Include this in the file with main() only, it defines the painting code.
+ * A local variable that is never written can leave painted bytes inside
+ * the stack, so the figure is slightly optimistic in theory, in practice
+ * return addresses and saved registers overwrite every frame.
+ */ 
+
+#ifndef STACK_H
+#define STACK_H
+
+#include <stdint.h>
+
+#define STACK_PAINT 0xC5	// Unlikely to be a real stack byte
+
+#ifdef __AVR__
+
+// Defined by the linker script
+extern uint8_t __data_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+
+// Paint the free RAM in .init1, before the stack pointer and the zero
+// register are set up, so no C code may be used
+static void stackPaint(void) __attribute__((naked, used, section(".init1")));
+static void
+stackPaint(void)
+{
+	__asm__ __volatile__(
+		"	ldi r30, lo8(_end)\n"
+		"	ldi r31, hi8(_end)\n"
+		"	ldi r24, %0\n"
+		"	ldi r25, hi8(__stack)\n"
+		"	rjmp 2f\n"
+		"1:	st Z+, r24\n"
+		"2:	cpi r30, lo8(__stack)\n"
+		"	cpc r31, r25\n"
+		"	brlo 1b\n"
+		"	breq 1b\n"
+		:: "M" (STACK_PAINT));
+}
+
+// Get the number of bytes the stack has never reached. The scan stops at
+// the given count, pass the previous result to only look at the part that
+// could have changed since, or 0xFFFF for a full scan.
+static inline uint16_t
+stackUnused(uint16_t previous)
+{
+	const uint8_t *byte = &_end;
+	uint16_t count = 0;
+	while (count < previous && byte + count <= &__stack
+		&& byte[count] == STACK_PAINT)
+	{
+		count += 1;
+	}
+	return count;
+}
+
+// Get the RAM taken by .data and .bss
+static inline uint16_t
+stackStatic(void)
+{
+	return &_end - &__data_start;
+}
+
+// Get the RAM left for the stack
+static inline uint16_t
+stackSize(void)
+{
+	return &__stack - &_end + 1;
+}
+
+#else
+
+// Host builds have no fixed RAM layout. The fake hardware tracks how deep
+// the stack of the host went instead, stackHostDeepest(), and it is shown
+// against a stack of STACK_HOST_SIZE. Host frames are a few times larger
+// than AVR ones, so only changes in the figure mean something.
+#define STACK_HOST_SIZE 16384	// Bytes
+
+uint16_t stackHostDeepest(void);
+
+static inline uint16_t
+stackUnused(uint16_t previous)
+{
+	uint16_t deepest = stackHostDeepest();
+	uint16_t unused = deepest < STACK_HOST_SIZE ? STACK_HOST_SIZE - deepest : 0;
+	return unused < previous ? unused : previous;
+}
+
+static inline uint16_t
+stackStatic(void)
+{
+	return 0;
+}
+
+static inline uint16_t
+stackSize(void)
+{
+	return STACK_HOST_SIZE;
+}
+
+#endif
+
+#endif
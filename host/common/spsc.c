@@ -0,0 +1,158 @@
+/*
+ * spsc.c
+ *
+ * Concurrency test of common/spsc.h. A producer thread pushes a numbered
+ * sequence through queues of a few sizes while the main thread pops it,
+ * checking that every item comes out once, in order and whole, and that a
+ * count of waiting items can always be popped. Items are wider than a
+ * word, so one read before its head was published shows up torn on a
+ * machine with more than one CPU. make spsc builds it with
+ * -fsanitize=thread, which also catches such a read on a single CPU.
+ *
+ *   make spsc
+ *
+ * The exit status is 1 if any queue failed, 66 if the sanitizer found a
+ * race.
+ */ 
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include "../../common/spsc.h"
+
+#define SPSC_ITEMS 200000	// Per queue, enough to wrap the indices many times
+
+struct spscItem {
+	uint32_t value;
+	uint32_t check;	// ~value
+};
+
+SPSC_QUEUE(smallQueue, struct spscItem, 2)
+SPSC_QUEUE(middleQueue, struct spscItem, 16)
+SPSC_QUEUE(fullQueue, struct spscItem, 256)
+
+static struct smallQueue small;
+static struct middleQueue middle;
+static struct fullQueue full;
+
+// One queue under test, the functions of its type behind pointers
+struct spscCase {
+	const char *name;
+	uint8_t (*push)(struct spscItem item);
+	uint8_t (*pop)(struct spscItem *item);
+	uint8_t (*count)(void);
+};
+
+#define SPSC_CASE(queue, type) \
+	static uint8_t queue##Push(struct spscItem item) { return type##Push(&queue, item); } \
+	static uint8_t queue##Pop(struct spscItem *item) { return type##Pop(&queue, item); } \
+	static uint8_t queue##Count(void) { return type##Count(&queue); }
+
+SPSC_CASE(small, smallQueue)
+SPSC_CASE(middle, middleQueue)
+SPSC_CASE(full, fullQueue)
+
+static const struct spscCase cases[] = {
+	{"2 items", smallPush, smallPop, smallCount},
+	{"16 items", middlePush, middlePop, middleCount},
+	{"256 items", fullPush, fullPop, fullCount},
+};
+
+// The machine may have a single CPU, a side that can't go on lets the
+// other one run
+static void *
+producer(void *arg)
+{
+	const struct spscCase *test = arg;
+	for (uint32_t i = 0; i < SPSC_ITEMS; )
+	{
+		struct spscItem item = {i, ~i};
+		if (test->push(item))
+		{
+			i++;
+		}
+		else
+		{
+			sched_yield();
+		}
+	}
+	return 0;
+}
+
+static int
+run(const struct spscCase *test)
+{
+	struct spscItem item;
+	if (test->pop(&item) || test->count() != 0)
+	{
+		printf("%-10s a new queue is not empty\n", test->name);
+		return 1;
+	}
+	pthread_t thread;
+	if (pthread_create(&thread, 0, producer, (void *) test) != 0)
+	{
+		printf("%-10s no thread\n", test->name);
+		return 1;
+	}
+	uint32_t expect = 0;
+	uint32_t popped = 0;
+	uint16_t most = 0;
+	int failed = 0;
+	while (popped < SPSC_ITEMS)
+	{
+		uint8_t count = test->count();
+		if (count > most)
+		{
+			most = count;
+		}
+		if (!test->pop(&item))
+		{
+			// Only this side takes items out
+			if (count != 0 && !failed)
+			{
+				printf("%-10s count %u but nothing to pop\n", test->name, count);
+				failed = 1;
+			}
+			sched_yield();
+			continue;
+		}
+		// After a failure the rest is only taken so the producer can finish
+		popped++;
+		if (failed)
+		{
+			continue;
+		}
+		if (item.value != expect || item.check != ~expect)
+		{
+			printf("%-10s got %u/%u, expected %u\n", test->name,
+				item.value, ~item.check, expect);
+			failed = 1;
+		}
+		expect++;
+	}
+	pthread_join(thread, 0);
+	if (!failed && (test->pop(&item) || test->count() != 0))
+	{
+		printf("%-10s not empty after the last item\n", test->name);
+		failed = 1;
+	}
+	if (!failed)
+	{
+		printf("%-10s ok, up to %u waiting\n", test->name, most);
+	}
+	return failed;
+}
+
+int
+main(void)
+{
+	int failed = 0;
+	for (unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		failed += run(&cases[i]);
+	}
+	printf("%u of %u queues passed\n",
+		(unsigned) (sizeof(cases) / sizeof(cases[0])) - failed,
+		(unsigned) (sizeof(cases) / sizeof(cases[0])));
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * clock.c
+ *
+ * Millisecond system clock on the virtual time.
+ */ 
+
+#include "clock.h"
+#include "sim.h"
+
+volatile uint32_t clockMilliseconds = 0;
+static void (*clockTick)(void) = 0;
+
+// Called every virtual millisecond, in place of the timer 5 ISR
+void
+simTick(void)
+{
+	clockMilliseconds++;
+	if (clockTick)
+	{
+		clockTick();
+	}
+	return;
+}
+
+void
+clockInit(void (*tick)(void))
+{
+	clockTick = tick;
+	return;
+}
+
+uint32_t
+clockMillis(void)
+{
+	simAdvance(SIM_POLL_US);
+	return clockMilliseconds;
+}
+
+uint32_t
+clockMicros(void)
+{
+	simAdvance(SIM_POLL_US);
+	return (uint32_t) simMicros();
+}
+
+uint32_t
+deadlineIn(uint32_t ms)
+{
+	return clockMillis() + ms;
+}
+
+uint8_t
+deadlinePassed(uint32_t deadline)
+{
+	return (int32_t) (clockMillis() - deadline) >= 0;
+}
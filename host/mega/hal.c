@@ -0,0 +1,350 @@
+/*
+ * hal.c
+ *
+ * Fake atmega2560 hardware for the host build. Every access takes the
+ * virtual time the real one takes. The inputs from the simulation set
+ * the scene the sensor sees, the key held on the keypad and the bytes
+ * the atmega328p sends.
+ */ 
+
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "echo.h"
+#include "sim.h"
+#include "trace.h"
+
+#define SIM_EEPROM_SIZE 4096
+#define SIM_RX_SIZE 256	// A power of two up to 256
+#define SIM_NEVER UINT64_MAX
+
+// What the sensor sees, the last echo or missed edge recorded
+#define SCENE_SILENT 0	// No echo starts, also before the first input
+#define SCENE_STUCK 1	// The echo starts but never ends
+#define SCENE_ECHO 2	// An echo of sceneWidth
+static uint8_t scene = SCENE_SILENT;
+static uint16_t sceneWidth = 0;
+static uint8_t trigger = 0;
+static uint64_t echoRiseAt = SIM_NEVER;
+static uint64_t echoFallAt = SIM_NEVER;
+static uint64_t echoTimerStart = 0;
+
+struct linkFramePool linkFrames;
+
+static uint8_t key = 'z';
+
+static uint8_t rxBuffer[SIM_RX_SIZE];
+static uint8_t rxHead = 0;
+static uint8_t rxTail = 0;
+
+static uint8_t eeprom[SIM_EEPROM_SIZE];
+static uint8_t eepromErased = 0;
+
+static const char *stackBase = 0;
+static uint16_t stackDeepest = 0;
+
+// Start measuring the stack. Call it from the function that runs the
+// firmware, the depth is taken from here.
+void
+simStackStart(void)
+{
+	stackBase = __builtin_frame_address(0);
+	stackDeepest = 0;
+	return;
+}
+
+// Note how deep the stack is. The simulation calls it whenever time moves,
+// which every wait of the firmware and every fake register does, and the
+// clock ticks run on top of it as the interrupts would.
+void
+simStackSample(void)
+{
+	if (!stackBase)
+	{
+		return;
+	}
+	size_t depth = stackBase - (const char *) __builtin_frame_address(0);
+	if (depth > stackDeepest)
+	{
+		stackDeepest = depth > 0xFFFF ? 0xFFFF : (uint16_t) depth;
+	}
+	return;
+}
+
+// Deepest stack seen, for stackUnused()
+uint16_t
+stackHostDeepest(void)
+{
+	return stackDeepest;
+}
+
+// Take an input from the simulation
+void
+simInput(const char *name, uint16_t arg)
+{
+	if (strcmp(name, "echo") == 0)
+	{
+		scene = SCENE_ECHO;
+		sceneWidth = arg;
+	}
+	else if (strcmp(name, "echo_lost") == 0)
+	{
+		// The argument is the level that was waited for and never came
+		scene = arg ? SCENE_SILENT : SCENE_STUCK;
+	}
+	else if (strcmp(name, "keyscan") == 0)
+	{
+		key = (uint8_t) arg;
+	}
+	else if (strcmp(name, "rx") == 0)
+	{
+		if (((rxHead + 1) & (SIM_RX_SIZE - 1)) != rxTail)
+		{
+			rxBuffer[rxHead] = (uint8_t) arg;
+			rxHead = (rxHead + 1) & (SIM_RX_SIZE - 1);
+		}
+	}
+	return;
+}
+
+void
+halDelayUs(uint16_t us)
+{
+	simAdvance(us);
+	return;
+}
+
+void
+halInterruptsOn(void)
+{
+	return;
+}
+
+uint8_t
+halInterruptsSave(void)
+{
+	return 0;
+}
+
+void
+halInterruptsRestore(uint8_t sreg)
+{
+	(void) sreg;
+	return;
+}
+
+void
+halLinkInit(uint16_t ubrr, uint8_t doubleSpeed)
+{
+	(void) ubrr;
+	(void) doubleSpeed;
+	return;
+}
+
+// Frames go out at once, as if the main loop waited for them
+void
+halLinkSend(struct linkFrame *frame)
+{
+	for (uint8_t i = 0; i < frame->length; i++)
+	{
+		simAdvance(SIM_LINK_BYTE_US);
+		traceEvent(TRACE_TX, frame->bytes[i]);
+	}
+	linkFramePoolFree(&linkFrames, frame);
+	return;
+}
+
+uint8_t
+halLinkReadable(void)
+{
+	simAdvance(SIM_POLL_US);
+	return rxHead != rxTail;
+}
+
+uint8_t
+halLinkRead(void)
+{
+	uint8_t data = rxBuffer[rxTail];
+	rxTail = (rxTail + 1) & (SIM_RX_SIZE - 1);
+	return data;
+}
+
+void
+halDebugInit(uint16_t ubrr, uint8_t doubleSpeed)
+{
+	(void) ubrr;
+	(void) doubleSpeed;
+	return;
+}
+
+uint8_t
+halDebugWritable(void)
+{
+	return 1;
+}
+
+void
+halDebugWrite(uint8_t data)
+{
+	fputc(data, stderr);
+	simAdvance(SIM_DEBUG_BYTE_US);
+	return;
+}
+
+uint8_t
+halDebugReadable(void)
+{
+	return 0;
+}
+
+uint8_t
+halDebugRead(void)
+{
+	return 0;
+}
+
+void
+halSensorInit(void)
+{
+	return;
+}
+
+// The echo starts after the trigger pulse ends, as on the HC-SR04
+void
+halTrigger(uint8_t level)
+{
+	if (trigger && !level)
+	{
+		echoRiseAt = scene == SCENE_SILENT ? SIM_NEVER : simMicros() + SIM_ECHO_DELAY_US;
+		echoFallAt = scene == SCENE_ECHO ? echoRiseAt + (uint64_t) sceneWidth * 16 : SIM_NEVER;
+	}
+	trigger = level;
+	return;
+}
+
+uint8_t
+halEcho(void)
+{
+	simAdvance(SIM_POLL_US);
+	uint64_t now = simMicros();
+	return now >= echoRiseAt && now < echoFallAt;
+}
+
+// The edges echo.c would capture from the times halTrigger() set
+void
+echoInit(void)
+{
+	return;
+}
+
+void
+echoArm(void)
+{
+	halEchoTimerReset();
+	echoRiseAt = SIM_NEVER;
+	echoFallAt = SIM_NEVER;
+	return;
+}
+
+uint8_t
+echoState(void)
+{
+	simAdvance(SIM_POLL_US);
+	uint64_t now = simMicros();
+	return now >= echoFallAt ? ECHO_DONE : now >= echoRiseAt ? ECHO_HIGH : ECHO_WAITING;
+}
+
+uint16_t
+echoRise(void)
+{
+	return (uint16_t) ((echoRiseAt - echoTimerStart) / 16);
+}
+
+uint16_t
+echoWidth(void)
+{
+	return (uint16_t) ((echoFallAt - echoRiseAt) / 16);
+}
+
+void
+halEchoTimerInit(void)
+{
+	return;
+}
+
+void
+halEchoTimerReset(void)
+{
+	echoTimerStart = simMicros();
+	return;
+}
+
+uint16_t
+halEchoTimerRead(void)
+{
+	return (uint16_t) ((simMicros() - echoTimerStart) / 16);
+}
+
+// There is no cycle counter, benchmarks come out as 0
+uint16_t
+halCyclesOpen(void)
+{
+	return 0;
+}
+
+void
+halCyclesClose(uint16_t saved)
+{
+	(void) saved;
+	return;
+}
+
+void
+halCyclesStart(void)
+{
+	return;
+}
+
+uint32_t
+halCyclesTaken(void)
+{
+	return 0;
+}
+
+// Starts out erased, as a new board
+uint8_t
+halEepromRead(uint16_t address)
+{
+	if (!eepromErased)
+	{
+		memset(eeprom, 0xFF, sizeof(eeprom));
+		eepromErased = 1;
+	}
+	return eeprom[address % SIM_EEPROM_SIZE];
+}
+
+void
+halEepromWrite(uint16_t address, uint8_t data)
+{
+	halEepromRead(address);
+	eeprom[address % SIM_EEPROM_SIZE] = data;
+	simAdvance(SIM_EEPROM_WRITE_US);
+	return;
+}
+
+void
+KEYPAD_Init(void)
+{
+	return;
+}
+
+// A scan drives the rows in turn and stops at the one with the key
+uint8_t
+KEYPAD_GetKey(void)
+{
+	static const char rows[] = "*741" "0852" "#963" "DCBA";
+	const char *found = key ? strchr(rows, key) : 0;
+	uint8_t scanned = found ? (found - rows) / 4 + 1 : 4;
+	simAdvance(scanned * SIM_KEYPAD_ROW_US);
+	return key;
+}
@@ -0,0 +1,132 @@
+/*
+ * sim.c
+ *
+ * Runs the atmega2560 firmware on a PC for tools/replay.py. Inputs are
+ * read from stdin as "<us> <event> <argument>" lines in time order and
+ * handed to the fake hardware when the virtual time reaches them, trace
+ * events go to stdout in the same form and the debug port to stderr. The
+ * run ends SIM_TAIL_US after the last input, with the deepest the stack
+ * went printed to stderr.
+ *
+ *   MotionAlarmMega [--speed factor] < inputs
+ *
+ * With a speed the virtual time is held back to that many times the real
+ * time, 0 runs as fast as possible.
+ */ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim.h"
+
+int firmwareMain(void);
+
+static uint64_t now = 0;
+static uint64_t nextMs = 1000;
+static double speed = 0;
+static uint64_t paceAt = 0;
+static struct timespec started;
+
+static uint64_t inputTime = 0;
+static char inputName[16];
+static unsigned inputArg = 0;
+static int inputPending = 0;
+static int inputsDone = 0;
+static uint64_t lastInput = 0;
+
+// Read the next input line, skipping anything malformed
+static void
+readInput(void)
+{
+	char line[64];
+	while (fgets(line, sizeof(line), stdin))
+	{
+		unsigned long long time;
+		if (sscanf(line, "%llu %15s %u", &time, inputName, &inputArg) == 3)
+		{
+			inputTime = time;
+			inputPending = 1;
+			return;
+		}
+	}
+	inputPending = 0;
+	inputsDone = 1;
+	return;
+}
+
+// Sleep until the real time has caught up with the virtual time
+static void
+pace(void)
+{
+	struct timespec wall;
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	double elapsed = (wall.tv_sec - started.tv_sec)
+		+ (wall.tv_nsec - started.tv_nsec) / 1e9;
+	double ahead = now / 1e6 / speed - elapsed;
+	if (ahead > 0)
+	{
+		struct timespec wait = {(time_t) ahead, (long) ((ahead - (time_t) ahead) * 1e9)};
+		nanosleep(&wait, 0);
+	}
+	return;
+}
+
+uint64_t
+simMicros(void)
+{
+	return now;
+}
+
+// Move the virtual time on, delivering the inputs and clock ticks that
+// fall into it
+void
+simAdvance(uint32_t us)
+{
+	simStackSample();
+	now += us;
+	while (inputPending && inputTime <= now)
+	{
+		simInput(inputName, (uint16_t) inputArg);
+		lastInput = inputTime;
+		readInput();
+	}
+	while (nextMs <= now)
+	{
+		nextMs += 1000;
+		simTick();
+	}
+	if (speed > 0 && now >= paceAt)
+	{
+		paceAt = now + 10000;
+		pace();
+	}
+	if (inputsDone && now > lastInput + SIM_TAIL_US)
+	{
+		fflush(stdout);
+		fprintf(stderr, "sim stack peak %u bytes\n", stackHostDeepest());
+		exit(0);
+	}
+	return;
+}
+
+int
+main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+		{
+			speed = atof(argv[++i]);
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--speed factor] < inputs\n", argv[0]);
+			return 2;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	readInput();
+	simStackStart();
+	return firmwareMain();
+}
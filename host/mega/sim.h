@@ -0,0 +1,32 @@
+/*
+ * sim.h
+ *
+ * Virtual time of the atmega2560 host build. Time only moves when the
+ * firmware waits or touches the fake hardware, each by the time it takes
+ * on the real board, so a run depends on nothing but its inputs.
+ */ 
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIM_POLL_US 1	// Reading a register or the clock
+#define SIM_LINK_BYTE_US 20	// A byte at 500000 baud
+#define SIM_DEBUG_BYTE_US 87	// A byte at 115200 baud
+#define SIM_EEPROM_WRITE_US 3400	// EEPROM byte write
+#define SIM_KEYPAD_ROW_US 1000	// Keypad scan delay per row
+#define SIM_ECHO_DELAY_US 460	// Trigger pulse end to echo start
+#define SIM_TAIL_US 2000000	// Time run after the last input
+
+uint64_t simMicros(void);
+void simAdvance(uint32_t us);
+
+// In hal.c and clock.c, called by the simulation
+void simInput(const char *name, uint16_t arg);
+void simTick(void);
+void simStackStart(void);
+void simStackSample(void);
+uint16_t stackHostDeepest(void);
+
+#endif
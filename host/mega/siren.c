@@ -0,0 +1,22 @@
+/*
+ * siren.c
+ *
+ * The host build has no buzzer, the patterns are only printed.
+ */ 
+
+#include <stdio.h>
+#include "siren.h"
+
+void
+sirenStart(uint8_t pattern)
+{
+	fprintf(stderr, "[siren %u]\n", pattern);
+	return;
+}
+
+void
+sirenStop(void)
+{
+	fprintf(stderr, "[siren off]\n");
+	return;
+}
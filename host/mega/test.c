@@ -0,0 +1,656 @@
+/*
+ * test.c
+ *
+ * Tests of the atmega2560 password entry, code slots and state machine on
+ * the fake hardware. Each test is a script of key presses, echoes and
+ * waits on the virtual time with the state and the codes sent to the
+ * atmega328p checked along the way. The firmware runs from its own main()
+ * in a child process per test, so every test starts from a blank EEPROM
+ * and power-on globals.
+ *
+ * A script can end in branches: the child runs up to there once, then
+ * forks again for every branch, e.g. every key sequence of a set of keys
+ * up to some length, checked against a model of the entry.
+ *
+ *   make test
+ *
+ * The exit status is 1 if any test failed.
+ */ 
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "hal.h"
+#include "pin.h"
+#include "sim.h"
+#include "trace.h"
+
+int firmwareMain(void);
+extern volatile uint8_t state;
+
+// EEPROM layout of pin.c, keep in step
+#define PIN_SINGLE_ADDRESS 16
+#define PIN_SINGLE_MARKER 0xA5
+#define PIN_RECORD_ADDRESS 64
+#define PIN_RECORD_SIZE (1 + PIN_SALT_SIZE + PIN_SLOTS * (1 + PIN_TAG_SIZE))
+
+// Codes of main.c, keep in step
+#define LOCKOUT 236
+#define PINREJECTED 237
+#define SLOTCLEARED 238
+#define ARMED 246
+#define MOVEMENT 247
+#define DISARMED 248
+#define TRIGGERED 249
+#define SETPASSWORD 251
+#define CORRECTPASS 252
+#define ALARMTIMEOUT 253
+#define WRONGPASS 254
+
+#define TEST_STEPS 128
+#define TEST_KEY_HOLD_MS 100	// Longer than a main loop, shorter than INPUTDELAY
+#define TEST_KEY_GAP_MS 350	// Release to the next press
+#define TEST_SETTLE_MS 1500	// Outcome messages hold the loop for 1000 ms
+#define TEST_ECHO_FAR 726	// Echo width in timer 4 ticks of 200 cm
+#define TEST_ECHO_NEAR 36	// 10 cm, closer than TRIGGER_DIST
+#define TEST_TIMEOUT_S 60	// Longest a single run may take
+#define TEST_STACK_LIMIT 4096	// Most stack in bytes of the host, the firmware takes a few hundred
+
+// Script steps, each is done when the virtual time reaches it and the next
+// one follows ms later
+#define STEP_KEY 1	// Press the key in arg
+#define STEP_RELEASE 2	// Release the keypad
+#define STEP_ECHO 3	// The sensor sees an echo of arg timer 4 ticks
+#define STEP_WAIT 4	// Nothing
+#define STEP_STATE 5	// The state must be arg
+#define STEP_SENT 6	// arg must have been sent since the last STEP_SENT
+#define STEP_BRANCH 7	// Fork for every branch
+
+struct testStep {
+	uint8_t type;
+	uint16_t arg;
+	uint16_t ms;
+};
+
+static struct testStep steps[TEST_STEPS];
+static uint8_t stepCount = 0;
+static uint8_t stepNext = 0;
+static uint64_t stepAt = 0;
+
+static const char *testName = "";
+static char branchName[32] = "";
+static uint16_t branchCount = 0;
+static void (*branchSteps)(uint16_t branch) = 0;
+static void (*setup)(void) = 0;	// Runs in the child before the firmware
+static uint8_t settingUp = 0;	// No time passes for the script during setup
+static uint8_t sent[256];
+static int report = 2;
+
+static uint64_t now = 0;
+static uint64_t nextMs = 1000;
+
+// Not used, only there for the statistics in main.c
+struct traceRecord traceBuffer[TRACE_SIZE];
+volatile uint8_t traceHead = 0;
+volatile uint8_t traceTail = 0;
+volatile uint16_t traceDropped = 0;
+
+static void
+step(uint8_t type, uint16_t arg, uint16_t ms)
+{
+	if (stepCount >= TEST_STEPS)
+	{
+		fprintf(stderr, "%s: script too long\n", testName);
+		exit(2);
+	}
+	steps[stepCount].type = type;
+	steps[stepCount].arg = arg;
+	steps[stepCount].ms = ms;
+	stepCount += 1;
+	return;
+}
+
+static void
+keys(const char *text)
+{
+	for (; *text; text++)
+	{
+		step(STEP_KEY, (uint8_t) *text, TEST_KEY_HOLD_MS);
+		step(STEP_RELEASE, 0, TEST_KEY_GAP_MS);
+	}
+	return;
+}
+
+static void
+hold(uint16_t ms)
+{
+	step(STEP_WAIT, 0, ms);
+	return;
+}
+
+static void
+expectState(uint8_t expected)
+{
+	step(STEP_STATE, expected, 0);
+	return;
+}
+
+static void
+expectSent(uint8_t code)
+{
+	step(STEP_SENT, code, 0);
+	return;
+}
+
+// Boot with the sensor seeing nothing close and wait for DISARMED
+static void
+boot(void)
+{
+	step(STEP_ECHO, TEST_ECHO_FAR, 500);
+	expectState(DISARMED);
+	return;
+}
+
+// Set the master code on a new system
+static void
+setMaster(const char *code)
+{
+	keys("*");
+	keys(code);
+	keys("#");
+	hold(TEST_SETTLE_MS);
+	expectSent(SETPASSWORD);
+	return;
+}
+
+static void
+fail(const char *what, unsigned expected, unsigned got)
+{
+	dprintf(report, "FAIL %s%s%s: %s, expected %u got %u at %llu ms\n",
+		testName, branchName[0] ? " " : "", branchName, what, expected,
+		got, (unsigned long long) (now / 1000));
+	_exit(1);
+}
+
+// Run the branches one child at a time and end with their result
+static void
+branch(void)
+{
+	uint8_t prefix = stepCount;
+	uint16_t failed = 0;
+	fflush(NULL);
+	for (uint16_t i = 0; i < branchCount; i++)
+	{
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			alarm(TEST_TIMEOUT_S);
+			stepCount = prefix;
+			branchSteps(i);
+			return;
+		}
+		int status = 1;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			failed += 1;
+		}
+	}
+	_exit(failed ? 1 : 0);
+}
+
+static void
+runStep(const struct testStep *current)
+{
+	switch (current->type)
+	{
+		case STEP_KEY:
+			simInput("keyscan", current->arg);
+			break;
+
+		case STEP_RELEASE:
+			simInput("keyscan", 'z');
+			break;
+
+		case STEP_ECHO:
+			simInput("echo", current->arg);
+			break;
+
+		case STEP_STATE:
+			if (state != current->arg)
+			{
+				fail("state", current->arg, state);
+			}
+			break;
+
+		case STEP_SENT:
+			if (!sent[current->arg])
+			{
+				fail("code not sent", current->arg, 0);
+			}
+			memset(sent, 0, sizeof(sent));
+			break;
+
+		case STEP_BRANCH:
+			branch();
+			break;
+	}
+	return;
+}
+
+uint64_t
+simMicros(void)
+{
+	return now;
+}
+
+// Move the virtual time on, running the clock and the script
+void
+simAdvance(uint32_t us)
+{
+	if (settingUp)
+	{
+		return;
+	}
+	simStackSample();
+	now += us;
+	while (nextMs <= now)
+	{
+		nextMs += 1000;
+		simTick();
+	}
+	while (stepAt <= now / 1000)
+	{
+		if (stepNext >= stepCount)
+		{
+			if (stackHostDeepest() > TEST_STACK_LIMIT)
+			{
+				fail("stack bytes", TEST_STACK_LIMIT, stackHostDeepest());
+			}
+			_exit(0);
+		}
+		const struct testStep *current = &steps[stepNext++];
+		runStep(current);
+		stepAt += current->ms;
+	}
+	return;
+}
+
+void
+traceEvent(uint8_t event, uint16_t arg)
+{
+	if (event == TRACE_TX)
+	{
+		sent[(uint8_t) arg] = 1;
+	}
+	return;
+}
+
+void
+traceService(void)
+{
+	return;
+}
+
+void
+traceFlush(void)
+{
+	return;
+}
+
+// Run the script built since the last run in a child, the firmware's
+// output is dropped and failures go to the original stderr
+static int
+run(void)
+{
+	fflush(NULL);
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		report = dup(2);
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, 1);
+		dup2(null, 2);
+		if (!branchSteps)
+		{
+			alarm(TEST_TIMEOUT_S);
+		}
+		if (setup)
+		{
+			settingUp = 1;
+			setup();
+			settingUp = 0;
+		}
+		simStackStart();
+		firmwareMain();
+		_exit(1);
+	}
+	int status = 1;
+	waitpid(pid, &status, 0);
+	int passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	if (!WIFEXITED(status))
+	{
+		fprintf(stderr, "FAIL %s: killed by signal %d\n", testName,
+			WTERMSIG(status));
+	}
+	printf("%-24s %s\n", testName, passed ? "ok" : "FAILED");
+	stepCount = 0;
+	branchSteps = 0;
+	setup = 0;
+	return passed;
+}
+
+static void
+begin(const char *name)
+{
+	testName = name;
+	stepCount = 0;
+	branchSteps = 0;
+	setup = 0;
+	return;
+}
+
+static void
+testBoot(void)
+{
+	begin("boot");
+	boot();
+	hold(1000);
+	expectState(DISARMED);
+	return;
+}
+
+static void
+testArmDisarm(void)
+{
+	begin("arm and disarm");
+	boot();
+	setMaster("1212");
+	keys("#");
+	hold(500);
+	expectState(ARMED);
+	keys("#1212#");
+	hold(TEST_SETTLE_MS);
+	expectSent(CORRECTPASS);
+	expectState(DISARMED);
+	return;
+}
+
+static void
+testWrongCode(void)
+{
+	begin("wrong code triggers");
+	boot();
+	setMaster("1212");
+	keys("#");
+	keys("#1213#");
+	hold(TEST_SETTLE_MS);
+	expectSent(WRONGPASS);
+	expectState(TRIGGERED);
+	// The alarm message is held for a second before the entry starts
+	hold(1000);
+	keys("1212#");
+	hold(TEST_SETTLE_MS);
+	expectState(DISARMED);
+	return;
+}
+
+static void
+testMovement(void)
+{
+	begin("movement then code");
+	boot();
+	setMaster("1212");
+	keys("#");
+	hold(500);
+	step(STEP_ECHO, TEST_ECHO_NEAR, 500);
+	expectState(MOVEMENT);
+	keys("#1212#");
+	hold(TEST_SETTLE_MS);
+	expectState(DISARMED);
+	return;
+}
+
+static void
+testAlarmTimeout(void)
+{
+	begin("movement times out");
+	boot();
+	setMaster("1212");
+	keys("#");
+	hold(500);
+	step(STEP_ECHO, TEST_ECHO_NEAR, 500);
+	expectState(MOVEMENT);
+	step(STEP_ECHO, TEST_ECHO_FAR, 11000);
+	expectSent(ALARMTIMEOUT);
+	expectState(TRIGGERED);
+	return;
+}
+
+static void
+testChangeCode(void)
+{
+	begin("change a slot code");
+	boot();
+	setMaster("1212");
+	keys("*1212#1#3434#");
+	hold(TEST_SETTLE_MS);
+	expectSent(SETPASSWORD);
+	keys("#");
+	keys("#3434#");
+	hold(TEST_SETTLE_MS);
+	expectState(DISARMED);
+	return;
+}
+
+static void
+testLockout(void)
+{
+	begin("lockout");
+	boot();
+	setMaster("1212");
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		keys("*9999#");
+		hold(TEST_SETTLE_MS);
+		expectSent(WRONGPASS);
+	}
+	keys("*");
+	hold(500);
+	expectSent(LOCKOUT);
+	expectState(DISARMED);
+	return;
+}
+
+// Leave the single PIN record of the firmware before the code slots: save
+// 1212 as the master code, move its salt and tag to the old record and
+// wipe the new one. Both firmwares hash an entry the same way.
+static void
+seedSinglePin(void)
+{
+	pinLoad();
+	pinBegin();
+	pinAbsorb('1');
+	pinAbsorb('2');
+	pinAbsorb('1');
+	pinAbsorb('2');
+	pinStore(PIN_MASTER);
+	for (uint8_t i = 0; i < PIN_SALT_SIZE + PIN_TAG_SIZE; i++)
+	{
+		// The salt is followed by the used flag of slot 0, then its tag
+		uint16_t from = PIN_RECORD_ADDRESS + 1 + i + (i >= PIN_SALT_SIZE);
+		halEepromWrite(PIN_SINGLE_ADDRESS + 1 + i, halEepromRead(from));
+	}
+	halEepromWrite(PIN_SINGLE_ADDRESS, PIN_SINGLE_MARKER);
+	for (uint16_t i = 0; i < PIN_RECORD_SIZE; i++)
+	{
+		halEepromWrite(PIN_RECORD_ADDRESS + i, 0xFF);
+	}
+	return;
+}
+
+// The PIN of an upgraded unit becomes the master code, so it still opens
+// the system and '*' asks for it before a code can be changed
+static void
+testSinglePinUpgrade(void)
+{
+	begin("single PIN upgrade");
+	setup = seedSinglePin;
+	boot();
+	keys("*5656#");
+	hold(TEST_SETTLE_MS);
+	expectSent(WRONGPASS);
+	keys("#");
+	hold(500);
+	expectState(ARMED);
+	keys("#1212#");
+	hold(TEST_SETTLE_MS);
+	expectSent(CORRECTPASS);
+	expectState(DISARMED);
+	return;
+}
+
+// A new slot code of every length: none clears the slot, up to
+// PIN_MIN_DIGITS - 1 digits is rejected, longer ones are saved and open
+// the system, digits past PIN_MAX_DIGITS are ignored
+static void
+slotCodeSteps(uint16_t digits)
+{
+	char code[PIN_MAX_DIGITS + 3] = "";
+	for (uint16_t i = 0; i < digits; i++)
+	{
+		code[i] = '3' + i % 7;
+	}
+	snprintf(branchName, sizeof(branchName), "\"%s\"", code);
+	keys("*1212#2#");
+	keys(code);
+	keys("#");
+	hold(TEST_SETTLE_MS);
+	if (digits == 0)
+	{
+		expectSent(SLOTCLEARED);
+		return;
+	}
+	if (digits < PIN_MIN_DIGITS)
+	{
+		expectSent(PINREJECTED);
+		return;
+	}
+	expectSent(SETPASSWORD);
+	code[digits > PIN_MAX_DIGITS ? PIN_MAX_DIGITS : digits] = '\0';
+	keys("#");
+	keys("#");
+	keys(code);
+	keys("#");
+	hold(TEST_SETTLE_MS);
+	expectState(DISARMED);
+	return;
+}
+
+static void
+testSlotCodeLengths(void)
+{
+	begin("slot code lengths");
+	boot();
+	setMaster("1212");
+	branchCount = PIN_MAX_DIGITS + 2;
+	branchSteps = slotCodeSteps;
+	step(STEP_BRANCH, 0, 0);
+	return;
+}
+
+// Every sequence of ENTRY_KEYS up to ENTRY_LENGTH keys followed by # while
+// armed, against a model of the entry: * removes the last digit, digits
+// past PIN_MAX_DIGITS are ignored and # is ignored before PIN_MIN_DIGITS
+#define ENTRY_KEYS "12*"
+#define ENTRY_LENGTH 6
+
+static void
+entrySteps(uint16_t branch)
+{
+	char sequence[ENTRY_LENGTH + 2];
+	char digits[PIN_MAX_DIGITS + 1];
+	uint8_t length = 0;
+	uint8_t count = 0;
+	// Branch numbers enumerate the sequences shortest first
+	uint16_t first = 1;
+	uint8_t keysUsed = 0;
+	while (branch >= first)
+	{
+		branch -= first;
+		first *= sizeof(ENTRY_KEYS) - 1;
+		keysUsed += 1;
+	}
+	for (uint8_t i = 0; i < keysUsed; i++)
+	{
+		char key = ENTRY_KEYS[branch % (sizeof(ENTRY_KEYS) - 1)];
+		branch /= sizeof(ENTRY_KEYS) - 1;
+		sequence[count++] = key;
+		if (key == '*' && length > 0)
+		{
+			length -= 1;
+		}
+		else if (key != '*' && length < PIN_MAX_DIGITS)
+		{
+			digits[length++] = key;
+		}
+	}
+	sequence[count++] = '#';
+	sequence[count] = '\0';
+	digits[length] = '\0';
+	snprintf(branchName, sizeof(branchName), "\"%s\"", sequence);
+	keys(sequence);
+	hold(TEST_SETTLE_MS);
+	if (length < PIN_MIN_DIGITS)
+	{
+		expectState(ARMED);
+	}
+	else if (strcmp(digits, "1212") == 0)
+	{
+		expectState(DISARMED);
+	}
+	else
+	{
+		expectState(TRIGGERED);
+	}
+	return;
+}
+
+static void
+testEntrySequences(void)
+{
+	begin("entry key sequences");
+	boot();
+	setMaster("1212");
+	keys("##");
+	branchCount = 0;
+	for (uint16_t n = 1, i = 0; i <= ENTRY_LENGTH; i++, n *= sizeof(ENTRY_KEYS) - 1)
+	{
+		branchCount += n;
+	}
+	branchSteps = entrySteps;
+	step(STEP_BRANCH, 0, 0);
+	return;
+}
+
+int
+main(void)
+{
+	static void (*const tests[])(void) = {
+		testBoot, testArmDisarm, testWrongCode, testMovement,
+		testAlarmTimeout, testChangeCode, testLockout, testSlotCodeLengths,
+		testEntrySequences, testSinglePinUpgrade,
+	};
+	unsigned failed = 0;
+	unsigned count = sizeof(tests) / sizeof(tests[0]);
+	for (unsigned i = 0; i < count; i++)
+	{
+		tests[i]();
+		failed += !run();
+	}
+	printf("%u of %u tests passed\n", count - failed, count);
+	return failed ? 1 : 0;
+}
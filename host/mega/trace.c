@@ -0,0 +1,48 @@
+/*
+ * trace.c
+ *
+ * Event trace of the host build, written to stdout as "<us> <event>
+ * <argument>" lines with the names tools/trace_decode.py uses.
+ */ 
+
+#include <stdio.h>
+#include "trace.h"
+#include "sim.h"
+
+static const char *const traceNames[] = {
+	"event0", "state", "key", "echo", "echo_lost", "tx", "rx", "flush",
+	"entry", "rtt", "keyscan",
+};
+
+// Not used, only there for the statistics in main.c
+struct traceRecord traceBuffer[TRACE_SIZE];
+volatile uint8_t traceHead = 0;
+volatile uint8_t traceTail = 0;
+volatile uint16_t traceDropped = 0;
+
+void
+traceEvent(uint8_t event, uint16_t arg)
+{
+	if (event < sizeof(traceNames) / sizeof(traceNames[0]))
+	{
+		printf("%llu %s %u\n", (unsigned long long) simMicros(), traceNames[event], arg);
+	}
+	else
+	{
+		printf("%llu event%u %u\n", (unsigned long long) simMicros(), event, arg);
+	}
+	return;
+}
+
+void
+traceService(void)
+{
+	return;
+}
+
+void
+traceFlush(void)
+{
+	fflush(stdout);
+	return;
+}
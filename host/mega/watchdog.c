@@ -0,0 +1,48 @@
+/*
+ * watchdog.c
+ *
+ * The host build has no watchdog, the virtual time only moves while the
+ * firmware runs, so a stall shows up in a replay as outputs that are late
+ * or missing.
+ */ 
+
+#include "watchdog.h"
+
+void
+watchdogTick(void)
+{
+	return;
+}
+
+void
+watchdogStart(void)
+{
+	return;
+}
+
+void
+watchdogCheckIn(void)
+{
+	return;
+}
+
+void
+watchdogBegin(uint8_t task)
+{
+	(void) task;
+	return;
+}
+
+void
+watchdogEnd(uint8_t task)
+{
+	(void) task;
+	return;
+}
+
+void
+watchdogReport(void (*print)(const char *text))
+{
+	print("reset by simulation\r\n");
+	return;
+}
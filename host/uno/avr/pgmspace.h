@@ -0,0 +1,15 @@
+/*
+ * pgmspace.h
+ *
+ * Enough of avr/pgmspace.h for lcd/lcd.h on the host, where program
+ * memory is just memory.
+ */ 
+
+#ifndef PGMSPACE_H
+#define PGMSPACE_H
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(address) (*(const unsigned char *) (address))
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * fuzz.c
+ *
+ * Fuzz target for the atmega328p: every input is a stream of bytes from
+ * the atmega2560 run through main.c from reset, with the fake hardware of
+ * hal.c and lcd.c checking the cursor, the LCD time spent on each byte,
+ * that no received byte is left unread and how deep the stack goes.
+ *
+ * Built with -fsanitize=fuzzer this is a libFuzzer target. With FUZZ_MAIN
+ * it gets a main() that runs the files named on the command line, or
+ * standard input, for AFL and for replaying a crash. host/uno/seeds keeps
+ * the streams that once failed, make fuzz-seeds runs them.
+ */ 
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "sim.h"
+
+int firmwareMain(void);
+
+// Globals of main.c, they start over for every input as after a reset
+extern uint8_t heartbeatsMissed;
+extern uint8_t lockoutShown;
+extern uint16_t clockOverflows;
+extern uint16_t stackFree;
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	heartbeatsMissed = 0;
+	lockoutShown = 0;
+	clockOverflows = 0;
+	stackFree = 0xFFFF;
+	simStart(data, size);
+	if (!setjmp(simEnd))
+	{
+		firmwareMain();
+	}
+	return 0;
+}
+
+#ifdef FUZZ_MAIN
+static int
+runFile(FILE *file)
+{
+	static uint8_t data[1 << 16];
+	size_t size = fread(data, 1, sizeof(data), file);
+	return LLVMFuzzerTestOneInput(data, size);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		return runFile(stdin);
+	}
+	for (int i = 1; i < argc; i++)
+	{
+		FILE *file = fopen(argv[i], "rb");
+		if (!file)
+		{
+			perror(argv[i]);
+			return 1;
+		}
+		runFile(file);
+		fclose(file);
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,216 @@
+/*
+ * hal.c
+ *
+ * Fake atmega328p hardware for the host build. The link receives the
+ * bytes of the input back to back at the link speed, a SIM_GAP byte
+ * stands for the atmega2560 falling silent. Bytes sent are dropped.
+ */ 
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include "hal.h"
+#include "sim.h"
+
+jmp_buf simEnd;
+
+static const uint8_t *input = 0;
+static size_t inputSize = 0;
+static size_t inputNext = 0;
+static uint64_t arrival = 0;	// When the next byte can be read
+static uint64_t lastRead = 0;
+
+static uint64_t now = 0;
+static uint32_t lcdBusy = 0;	// LCD time since the last byte read or wait
+static const char *stackBase = 0;
+static size_t stackDeepest = 0;
+
+static uint64_t clockStart = 0;
+static uint32_t clockCleared = 0;	// Overflows already flagged
+
+// Start a run on an input. Call it from the function that runs main.c,
+// its stack use is measured from here.
+void
+simStart(const uint8_t *data, size_t size)
+{
+	input = data;
+	inputSize = size;
+	inputNext = 0;
+	arrival = 0;
+	lastRead = 0;
+	now = 0;
+	lcdBusy = 0;
+	stackBase = __builtin_frame_address(0);
+	stackDeepest = 0;
+	clockStart = 0;
+	clockCleared = 0;
+	simLcdReset();
+	return;
+}
+
+void
+simFail(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	fprintf(stderr, "at %llu us, byte %zu: ", (unsigned long long) now, inputNext);
+	vfprintf(stderr, format, args);
+	fputc('\n', stderr);
+	va_end(args);
+	simLcdShow();
+	abort();
+}
+
+// Let the silence of any gaps in front of the next byte pass
+static void
+skipGaps(void)
+{
+	while (inputNext < inputSize && input[inputNext] == SIM_GAP)
+	{
+		arrival += SIM_GAP_US;
+		inputNext += 1;
+	}
+	return;
+}
+
+uint64_t
+simMicros(void)
+{
+	return now;
+}
+
+void
+simAdvance(uint32_t us)
+{
+	now += us;
+	skipGaps();
+	// Falling behind the atmega2560 is for the LCD budget to catch, this
+	// is only about not reading at all
+	uint64_t waiting = arrival > lastRead ? arrival : lastRead;
+	if (inputNext < inputSize && now > waiting + SIM_LOCKUP_US)
+	{
+		simFail("lockup, no byte read for %llu us with one waiting",
+			(unsigned long long) (now - waiting));
+	}
+	return;
+}
+
+// The LCD is driven by busy waiting, so its time passes too
+void
+simLcdBusy(uint32_t us)
+{
+	lcdBusy += us;
+	simAdvance(us);
+	return;
+}
+
+// Check the LCD time spent on the last byte read, or on the timeout that
+// ended the last wait
+static void
+lcdBudget(void)
+{
+	if (lcdBusy > SIM_LCD_BUDGET_US)
+	{
+		simFail("%lu us of LCD writes for one byte or timeout", (unsigned long) lcdBusy);
+	}
+	lcdBusy = 0;
+	return;
+}
+
+// Only used while waiting for a byte
+void
+halDelayMs(uint16_t ms)
+{
+	lcdBudget();
+	simAdvance(ms * 1000UL);
+	return;
+}
+
+void
+halLinkInit(uint16_t ubrr, uint8_t doubleSpeed)
+{
+	(void) ubrr;
+	(void) doubleSpeed;
+	return;
+}
+
+uint8_t
+halLinkWritable(void)
+{
+	return 1;
+}
+
+void
+halLinkWrite(uint8_t data)
+{
+	(void) data;
+	simAdvance(SIM_LINK_BYTE_US);
+	return;
+}
+
+// Polled by every wait for a byte, so the stack is checked here too. The
+// run ends when a byte is waited for after the last one.
+uint8_t
+halLinkReadable(void)
+{
+	size_t depth = stackBase - (const char *) __builtin_frame_address(0);
+	if (depth > stackDeepest)
+	{
+		stackDeepest = depth;
+	}
+	if (depth > SIM_STACK_LIMIT)
+	{
+		simFail("stack of %zu bytes", depth);
+	}
+	simAdvance(SIM_POLL_US);
+	if (inputNext == inputSize)
+	{
+		longjmp(simEnd, 1);
+	}
+	return now >= arrival;
+}
+
+// Deepest stack seen by halLinkReadable(), for stackUnused()
+uint16_t
+stackHostDeepest(void)
+{
+	return stackDeepest > 0xFFFF ? 0xFFFF : (uint16_t) stackDeepest;
+}
+
+uint8_t
+halLinkRead(void)
+{
+	lcdBudget();
+	lastRead = now;
+	uint8_t data = input[inputNext];
+	inputNext += 1;
+	arrival += SIM_LINK_BYTE_US;
+	return data;
+}
+
+void
+halClockInit(void)
+{
+	clockStart = now;
+	clockCleared = 0;
+	return;
+}
+
+uint16_t
+halClockCount(void)
+{
+	simAdvance(SIM_POLL_US);
+	return (uint16_t) ((now - clockStart) / 64);
+}
+
+uint8_t
+halClockOverflowed(void)
+{
+	uint32_t overflows = (uint32_t) ((now - clockStart) / 64 >> 16);
+	if (overflows > clockCleared)
+	{
+		clockCleared = overflows;
+		return 1;
+	}
+	return 0;
+}
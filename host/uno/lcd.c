@@ -0,0 +1,163 @@
+/*
+ * lcd.c
+ *
+ * Fake HD44780 behind the lcd/lcd.h interface for the host build. It
+ * keeps the cursor and the characters shown, fails the run on a cursor
+ * moved or a character written outside the display, and charges every
+ * command the time the controller is busy with it.
+ */ 
+
+#include <stdio.h>
+#include <string.h>
+#include "lcd/lcd.h"
+#include "sim.h"
+
+#define LCD_BUSY_US 40	// Most commands and every character
+#define LCD_BUSY_CLEAR_US 1640	// Clear and home
+
+static char lcdText[LCD_LINES][LCD_DISP_LENGTH];
+static uint8_t lcdX = 0;
+static uint8_t lcdY = 0;
+static uint8_t lcdStep = 0;
+
+void
+simLcdReset(void)
+{
+	memset(lcdText, ' ', sizeof(lcdText));
+	lcdX = 0;
+	lcdY = 0;
+	lcdStep = 0;
+	return;
+}
+
+// Print what the display shows
+void
+simLcdShow(void)
+{
+	for (uint8_t y = 0; y < LCD_LINES; y++)
+	{
+		fprintf(stderr, "|%.*s|\n", LCD_DISP_LENGTH, lcdText[y]);
+	}
+	return;
+}
+
+// Get the characters of a line, LCD_DISP_LENGTH of them without a '\0'
+const char *
+simLcdLine(uint8_t y)
+{
+	return lcdText[y];
+}
+
+void
+simLcdCursor(uint8_t *x, uint8_t *y)
+{
+	*x = lcdX;
+	*y = lcdY;
+	return;
+}
+
+// Same power-on delays as the real lcd_init_step()
+uint16_t
+lcd_init_step(uint8_t dispAttr)
+{
+	static const uint16_t delays[] = {LCD_DELAY_BOOTUP, LCD_DELAY_INIT,
+		LCD_DELAY_INIT_REP, LCD_DELAY_INIT_REP, LCD_DELAY_INIT_4BIT, 0};
+	(void) dispAttr;
+	uint16_t delay = delays[lcdStep];
+	lcdStep = delay ? lcdStep + 1 : 0;
+	return delay;
+}
+
+void
+lcd_init(uint8_t dispAttr)
+{
+	while (lcd_init_step(dispAttr)) {}
+	return;
+}
+
+void
+lcd_clrscr(void)
+{
+	memset(lcdText, ' ', sizeof(lcdText));
+	lcdX = 0;
+	lcdY = 0;
+	simLcdBusy(LCD_BUSY_CLEAR_US);
+	return;
+}
+
+void
+lcd_home(void)
+{
+	lcdX = 0;
+	lcdY = 0;
+	simLcdBusy(LCD_BUSY_CLEAR_US);
+	return;
+}
+
+void
+lcd_gotoxy(uint8_t x, uint8_t y)
+{
+	if (x >= LCD_DISP_LENGTH || y >= LCD_LINES)
+	{
+		simFail("cursor moved to %u,%u", x, y);
+	}
+	lcdX = x;
+	lcdY = y;
+	simLcdBusy(LCD_BUSY_US);
+	return;
+}
+
+// Lines don't wrap (LCD_WRAP_LINES 0), a newline moves to the start of
+// the other line
+void
+lcd_putc(char c)
+{
+	if (c == '\n')
+	{
+		lcdX = 0;
+		lcdY = (lcdY + 1) % LCD_LINES;
+	}
+	else
+	{
+		if (lcdX >= LCD_DISP_LENGTH)
+		{
+			simFail("character 0x%02x written at %u,%u", (uint8_t) c, lcdX, lcdY);
+		}
+		lcdText[lcdY][lcdX] = c;
+		lcdX += 1;
+	}
+	simLcdBusy(LCD_BUSY_US);
+	return;
+}
+
+void
+lcd_puts(const char *s)
+{
+	while (*s)
+	{
+		lcd_putc(*s++);
+	}
+	return;
+}
+
+void
+lcd_puts_p(const char *progmem_s)
+{
+	lcd_puts(progmem_s);
+	return;
+}
+
+void
+lcd_command(uint8_t cmd)
+{
+	(void) cmd;
+	simLcdBusy(LCD_BUSY_US);
+	return;
+}
+
+void
+lcd_data(uint8_t data)
+{
+	lcd_putc((char) data);
+	return;
+}
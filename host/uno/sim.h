@@ -0,0 +1,38 @@
+/*
+ * sim.h
+ *
+ * Virtual time and checks of the atmega328p host build. The fake link
+ * hands main.c the bytes of one fuzz input, time moves only when the
+ * firmware waits or drives the LCD, and every check that fails aborts the
+ * run so the fuzzer keeps the input.
+ */ 
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+#define SIM_LINK_BYTE_US 20	// A byte at 500000 baud
+#define SIM_POLL_US 1	// Reading a register
+#define SIM_GAP 0xFF	// Input byte for a silent link, never sent by the atmega2560
+#define SIM_GAP_US 5100000	// Longer than the longest receiveData() timeout
+#define SIM_LOCKUP_US 1000000	// Longest time without a read while a byte is waiting
+#define SIM_LCD_BUDGET_US 4000	// Most LCD time per byte received or timeout, a clear and a full screen take 2920
+#define SIM_STACK_LIMIT 16384	// Most stack in bytes, the atmega328p has 2 KB of RAM
+
+// Jumped to when main.c waits for a byte after the last one
+extern jmp_buf simEnd;
+
+void simStart(const uint8_t *data, size_t size);
+uint64_t simMicros(void);
+void simAdvance(uint32_t us);
+void simLcdBusy(uint32_t us);
+void simLcdReset(void);
+void simLcdShow(void);
+const char *simLcdLine(uint8_t y);
+void simLcdCursor(uint8_t *x, uint8_t *y);
+void simFail(const char *format, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * test.c
+ *
+ * Tests of the atmega328p keypad entry and display on the fake hardware
+ * of the fuzz target. Each test is a stream of bytes from the atmega2560,
+ * run through main.c from reset until it waits for the next byte, and the
+ * text on the LCD and the cursor are checked then. The fakes abort on a
+ * cursor or a character outside the display, so every test runs in a
+ * child process.
+ *
+ *   make test
+ *
+ * The exit status is 1 if any test failed.
+ */ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "lcd/lcd.h"
+#include "sim.h"
+
+int firmwareMain(void);
+
+// The atmega2560 is silent until the LCD is ready, then answers the
+// handshake with CONNECT
+#define HANDSHAKE "\xff\x6f"
+
+// The codes of main.c in the streams: \xef SLOTINPUT, \xf1 COUNTDOWN,
+// \xfa INPUT, \xfb SETPASSWORD, \xfc CORRECTPASS
+
+struct unoTest {
+	const char *name;
+	const char *stream;	// Bytes after the handshake
+	const char *lines[LCD_LINES];	// Trailing spaces left out
+	uint8_t x;	// Cursor
+	uint8_t y;
+};
+
+static const struct unoTest tests[] = {
+	{"digit limit", "\xfa" "1234567890",
+		{"Input password:", "12345678"}, 8, 1},
+	{"backspace", "\xfa" "*123*4**",
+		{"Input password:", "1"}, 1, 1},
+	{"countdown redraw", "\xfa" "12\xf1\x1e" "3",
+		{"Input password:", "123          30s"}, 3, 1},
+	{"countdown at the limit", "\xfa" "1234567812345678\xf1\x27",
+		{"Input password:", "12345678     39s"}, 8, 1},
+	{"countdown out of range", "\xfa" "12\xf1\xf0",
+		{"Input password:", "12"}, 2, 1},
+	{"entry result", "\xfa" "1212#\xfc",
+		{"Correct password", ""}, 16, 0},
+	{"slot then code", "\xef" "2#\xfa" "3434#\xfb",
+		{"Password set", ""}, 12, 0},
+};
+
+// Check a line of the LCD against the expected text padded with spaces
+static int
+lineMatches(uint8_t y, const char *expected)
+{
+	char padded[LCD_DISP_LENGTH + 1];
+	snprintf(padded, sizeof(padded), "%-*s", LCD_DISP_LENGTH, expected);
+	return memcmp(simLcdLine(y), padded, LCD_DISP_LENGTH) == 0;
+}
+
+// Run one test in the current process and exit with its result
+static void
+runTest(const struct unoTest *test)
+{
+	static uint8_t data[256];
+	size_t size = strlen(HANDSHAKE);
+	memcpy(data, HANDSHAKE, size);
+	memcpy(data + size, test->stream, strlen(test->stream));
+	size += strlen(test->stream);
+	simStart(data, size);
+	if (!setjmp(simEnd))
+	{
+		firmwareMain();
+	}
+
+	int failed = 0;
+	for (uint8_t y = 0; y < LCD_LINES; y++)
+	{
+		if (!lineMatches(y, test->lines[y]))
+		{
+			fprintf(stderr, "FAIL %s: line %u should be \"%s\"\n", test->name,
+				y, test->lines[y]);
+			failed = 1;
+		}
+	}
+	uint8_t x;
+	uint8_t y;
+	simLcdCursor(&x, &y);
+	if (x != test->x || y != test->y)
+	{
+		fprintf(stderr, "FAIL %s: cursor at %u,%u, expected %u,%u\n",
+			test->name, x, y, test->x, test->y);
+		failed = 1;
+	}
+	if (failed)
+	{
+		simLcdShow();
+	}
+	exit(failed);
+}
+
+int
+main(void)
+{
+	unsigned failed = 0;
+	unsigned count = sizeof(tests) / sizeof(tests[0]);
+	for (unsigned i = 0; i < count; i++)
+	{
+		fflush(NULL);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			runTest(&tests[i]);
+		}
+		int status = 1;
+		waitpid(pid, &status, 0);
+		int passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		printf("%-24s %s\n", tests[i].name, passed ? "ok" : "FAILED");
+		failed += !passed;
+	}
+	printf("%u of %u tests passed\n", count - failed, count);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+#
+# latency_report.py
+#
+# Bound the interrupt latency of every vector of the atmega2560 from its
+# listing (.lss) and check it against the budgets in
+# MotionAlarmMega/latency.h:
+#
+#   tools/latency_report.py build/Release/MotionAlarmMega/MotionAlarmMega.lss
+#
+# A vector is taken at the latest after the longest time anything else
+# holds interrupts off: another handler from its entry until it turns them
+# back on or returns, or a cli() section of the main code until SREG is
+# restored. Its latency is that plus its own entry, the interrupt
+# response, the jump in the vector table and the prologue up to the first
+# instruction of its work. Cycles are counted as in size_report.py, every
+# instruction of a stretch once with the calls in it, so both sides of a
+# branch are paid for but loops only once.
+#
+# With --console, the "isr" output of the debug console is read from a
+# capture of the debug port and the latencies measured on the board are
+# checked too. The exit status is 1 if anything is over its budget.
+
+import argparse
+import os
+import re
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from size_report import BIG_PC, cycles
+
+# Vectors of the interrupt policy, by avr-libc vector number
+VECTORS = {6: "echo", 35: "siren", 36: "link_rx", 37: "link_tx",
+	47: "clock"}
+HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..",
+	"MotionAlarmMega", "latency.h")
+
+# Only run before the sensor is used, with interrupts off on purpose
+IGNORE = {"pinBenchmark"}
+
+FUNCTION = re.compile(r"^([0-9a-f]+) <([^>]+)>:$")
+INSTRUCTION = re.compile(r"^\s+[0-9a-f]+:\t(?:[0-9a-f]{2} )+\s*\t(\S+)\s*([^;]*)")
+TARGET = re.compile(r"<([^>+]+)>")
+BUDGET = re.compile(r"^#define LATENCY_BUDGET_(\w+)\s+(\d+)", re.M)
+MEASURED = re.compile(r"^(\w+)\s+(\d+)\s+(\d+)\s+(\d+)", re.M)
+SREG = "0x3f"
+
+
+def base_name(name):
+	# LTO renames static functions, e.g. foo.lto_priv.0
+	return name.split(".")[0]
+
+
+# Get {function: [(mnemonic, operands, call target)]} from a listing
+def read_listing(path):
+	functions = {}
+	name = None
+	with open(path, errors="replace") as listing:
+		for line in listing:
+			match = FUNCTION.match(line)
+			if match:
+				name = base_name(match.group(2))
+				functions.setdefault(name, [])
+				continue
+			match = INSTRUCTION.match(line)
+			if match and name:
+				operands = match.group(2).strip()
+				target = None
+				if match.group(1) in ("call", "rcall"):
+					found = TARGET.search(line)
+					# rcall .+0 only makes room on the stack
+					if found and base_name(found.group(1)) != name:
+						target = base_name(found.group(1))
+				functions[name].append((match.group(1), operands, target))
+	return functions
+
+
+# Count the cycles of a stretch of instructions and of the calls in it
+def stretch(code, functions, big_pc, memo):
+	total = 0
+	for mnemonic, _, target in code:
+		total += cycles(mnemonic, big_pc)
+		if target:
+			total += body(target, functions, big_pc, memo)
+	return total
+
+
+def body(name, functions, big_pc, memo):
+	if name not in memo:
+		# Recursion is counted once
+		memo[name] = 0
+		memo[name] = stretch(functions.get(name, []), functions, big_pc, memo)
+	return memo[name]
+
+
+# Get the end of the stretch from an index that interrupts stay off for:
+# up to a sei, a return from the handler, or an SREG restore outside one
+def held_until(code, start, handler):
+	for index in range(start, len(code)):
+		mnemonic, operands, _ = code[index]
+		if mnemonic in ("sei", "reti"):
+			return index + 1
+		if not handler and mnemonic == "out" and operands.startswith(SREG):
+			return index + 1
+	return len(code)
+
+
+def prologue_end(code):
+	for index, (mnemonic, operands, _) in enumerate(code):
+		if mnemonic == "push" or (mnemonic == "in" and operands.endswith(SREG)):
+			continue
+		if mnemonic in ("eor", "clr") and operands.startswith("r1"):
+			continue
+		# RAMPZ and EIND saved with r0
+		if mnemonic == "in" and operands.startswith("r0"):
+			continue
+		if mnemonic == "out" and operands.endswith("r0"):
+			continue
+		return index + 1
+	return len(code)
+
+
+def analyse(functions, big_pc):
+	memo = {}
+	# Interrupt response with the return address pushed, and the jmp in
+	# the vector table
+	response = (5 if big_pc else 4) + 3
+	entries = {}
+	held = {}
+	sections = []
+	for name, code in functions.items():
+		handler = name.startswith("__vector_")
+		if handler:
+			entries[name] = response + stretch(code[:prologue_end(code)],
+				functions, big_pc, memo)
+			held[name] = response + stretch(code[:held_until(code, 0, True)],
+				functions, big_pc, memo)
+		if name in IGNORE:
+			continue
+		for index, (mnemonic, _, _) in enumerate(code):
+			if mnemonic == "cli":
+				end = held_until(code, index, handler)
+				sections.append((stretch(code[index:end], functions, big_pc,
+					memo), name))
+	return entries, held, sections
+
+
+def main():
+	parser = argparse.ArgumentParser(
+		description="Bound the interrupt latencies and check them against the budgets")
+	parser.add_argument("listing", help="listing of the atmega2560 build")
+	parser.add_argument("--mcu", default="atmega2560")
+	parser.add_argument("--console", help="capture of the debug port with "
+		"the output of the \"isr\" console command")
+	args = parser.parse_args()
+
+	with open(HEADER) as header:
+		budgets = {name.lower(): int(value)
+			for name, value in BUDGET.findall(header.read())}
+	measured = {}
+	if args.console:
+		with open(args.console, "rb") as capture:
+			text = capture.read().decode("ascii", "replace")
+		for name, worst, _, _ in MEASURED.findall(text):
+			# The last report in the capture counts
+			if name in VECTORS.values():
+				measured[name] = int(worst)
+
+	functions = read_listing(args.listing)
+	entries, held, sections = analyse(functions, args.mcu in BIG_PC)
+	section = max(sections, default=(0, "-"))
+	print("longest cli section: %d cycles in %s" % section)
+
+	over = False
+	print("%-8s %-12s %6s %6s %6s %6s %8s" % ("vector", "held off by",
+		"entry", "held", "bound", "budget", "measured"))
+	for number, vector in sorted(VECTORS.items()):
+		name = "__vector_%d" % number
+		if name not in entries:
+			print("%-8s not in the listing" % vector)
+			continue
+		blocker = max([(cycles, other) for other, cycles in held.items()
+			if other != name] + [section])
+		bound = entries[name] + blocker[0]
+		budget = budgets.get(vector)
+		value = measured.get(vector)
+		late = (budget is not None and (bound > budget
+			or (value is not None and value > budget)))
+		over = over or late
+		print("%-8s %-12s %6d %6d %6d %6s %8s%s" % (vector, blocker[1][:12],
+			entries[name], held[name], bound, "-" if budget is None else budget,
+			"-" if value is None else value, " over" if late else ""))
+	return 1 if over else 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+#
+# replay.py
+#
+# Judge firmware versions on the same recorded input. A recording is a
+# capture of the debug port of an atmega2560 built with TRACE_RECORD 1 (see
+# MotionAlarmMega/trace.h): it holds every echo width and lost edge, every
+# keypad press and release and every byte from the atmega328p, with the
+# states, keys taken and bytes sent that came out of them.
+#
+#   tools/replay.py capture.bin                 # the live run itself
+#   tools/replay.py capture.bin --sim build/sim/old --sim build/sim/new
+#
+# Each --sim is a simulation build of MotionAlarmMega (make sim). The inputs are
+# written to its standard input, one per line, and it writes every trace
+# event of the firmware to its standard output the same way:
+#
+#   <microseconds> <event> <argument>
+#
+# with the event names of tools/trace_decode.py, e.g. "1520000 keyscan 49"
+# in and "1520408 tx 49" out. The simulation runs on the times of the
+# inputs, --speed is passed on to it: 0 runs as fast as it can, 1 in real
+# time, 10 ten times faster.
+#
+# For every run the tool prints the motion detection latency (from the
+# first echo closer than the trigger distance while armed to the change to
+# MOVEMENT), the number of detections and alarms, and the distribution of
+# the latency from a key taken to the first byte that changes the LCD.
+
+import argparse
+import os
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from trace_decode import EVENTS, decode
+
+INPUTS = ("echo", "echo_lost", "keyscan", "rx")
+
+# From MotionAlarmMega/main.c
+TRIGGER_TICKS = 109	# TRIGGER_DIST of 30 cm in timer 4 ticks
+ARMED = 246
+MOVEMENT = 247
+TRIGGERED = 249
+SCREEN = 242
+SCREEN_END = 127
+
+# Payload bytes after the codes sent to the atmega328p, and the codes that
+# don't change what the LCD shows
+PAYLOAD = {236: 1, 241: 1, 243: 3, 244: 1, 245: 3}
+BACKGROUND = {111, 235, 241, 243, 244, 245}
+
+
+# Get the events of a recording as (time_us, name, arg), starting at 0
+def read_recording(path, force):
+	with open(path, "rb") as capture:
+		data = capture.read()
+	events = []
+	dropped = 0
+	for item in decode(data):
+		if item[0] == "dropped":
+			dropped += item[1]
+		elif item[0] == "event":
+			_, time, event, arg = item
+			events.append((time, EVENTS.get(event, "event%d" % event), arg))
+	if dropped and not force:
+		sys.exit("%s: %d records were dropped, the recording is incomplete "
+			"(--force to use it anyway)" % (path, dropped))
+	if not events:
+		sys.exit("%s: no trace frames" % path)
+	start = events[0][0]
+	return [(time - start, name, arg) for time, name, arg in events]
+
+
+# Run a simulation build on the inputs and get the events it traced
+def simulate(sim, inputs, speed):
+	lines = "".join("%d %s %d\n" % event for event in inputs)
+	result = subprocess.run([sim, "--speed", str(speed)], input=lines,
+		capture_output=True, text=True)
+	if result.returncode != 0:
+		sys.exit("%s failed: %s" % (sim, result.stderr.strip()))
+	events = []
+	for line in result.stdout.splitlines():
+		fields = line.split()
+		if len(fields) == 3 and fields[0].isdigit():
+			events.append((int(fields[0]), fields[1], int(fields[2])))
+	return events
+
+
+def percentile(values, percent):
+	return values[min(len(values) - 1, len(values) * percent // 100)]
+
+
+# Get the metrics of a run from its events in time order. The inputs of
+# the recording are merged in so the echo times are known for a simulation
+# too.
+def measure(events):
+	detections = []
+	alarms = 0
+	armed_at = None
+	close_at = None
+	key_at = None
+	key_latencies = []
+	payload = 0
+	in_screen = False
+	for time, name, arg in events:
+		if name == "state":
+			if arg == ARMED:
+				armed_at = time
+				close_at = None
+			elif arg == MOVEMENT and armed_at is not None:
+				if close_at is not None:
+					detections.append(time - close_at)
+				armed_at = None
+			elif arg == TRIGGERED:
+				alarms += 1
+				armed_at = None
+			else:
+				armed_at = None
+		elif name == "echo":
+			if armed_at is not None and close_at is None and arg < TRIGGER_TICKS:
+				close_at = time
+		elif name == "key":
+			key_at = time
+		elif name == "tx":
+			# Skip the payloads of the messages that don't change the LCD
+			if payload:
+				payload -= 1
+				continue
+			if in_screen:
+				in_screen = arg != SCREEN_END
+				continue
+			payload = PAYLOAD.get(arg, 0)
+			if arg in BACKGROUND:
+				continue
+			in_screen = arg == SCREEN
+			if key_at is not None:
+				key_latencies.append(time - key_at)
+				key_at = None
+	return detections, alarms, sorted(key_latencies)
+
+
+def report(title, events):
+	detections, alarms, keys = measure(events)
+	print(title)
+	if detections:
+		print("  detection latency: %d detections, min %d us, median %d us, max %d us" % (
+			len(detections), min(detections), percentile(sorted(detections), 50),
+			max(detections)))
+	else:
+		print("  detection latency: no detections")
+	print("  alarms: %d" % alarms)
+	if keys:
+		print("  key to LCD: %d keys, min %d us, p50 %d us, p95 %d us, max %d us" % (
+			len(keys), keys[0], percentile(keys, 50), percentile(keys, 95),
+			keys[-1]))
+	else:
+		print("  key to LCD: no keys")
+
+
+def main():
+	parser = argparse.ArgumentParser(
+		description="Replay a recording and compare firmware versions")
+	parser.add_argument("recording", help="capture of a TRACE_RECORD build")
+	parser.add_argument("--sim", action="append", default=[],
+		help="simulation build to replay into, may be repeated")
+	parser.add_argument("--speed", type=float, default=0,
+		help="replay speed, 0 for as fast as possible")
+	parser.add_argument("--force", action="store_true",
+		help="use a recording with dropped records")
+	args = parser.parse_args()
+
+	recorded = read_recording(args.recording, args.force)
+	inputs = [event for event in recorded if event[1] in INPUTS]
+	print("%s: %d inputs over %.1f s" % (args.recording, len(inputs),
+		recorded[-1][0] / 1e6))
+
+	report("recorded run", recorded)
+	for sim in args.sim:
+		outputs = simulate(sim, inputs, args.speed)
+		# Inputs sort before outputs at the same time
+		merged = sorted(inputs + [event for event in outputs
+			if event[1] not in INPUTS], key=lambda event: (event[0],
+			event[1] not in INPUTS))
+		report(sim, merged)
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+#
+# size_report.py
+#
+# Compare the functions of two builds from their avr-objdump listings (.lss),
+# e.g. the Debug and Release builds made by the top level Makefile:
+#
+#   tools/size_report.py --mcu atmega2560 \
+#       build/Debug/MotionAlarmMega/MotionAlarmMega.lss \
+#       build/Release/MotionAlarmMega/MotionAlarmMega.lss
+#
+# For every function it prints the size in bytes and a cycle count in both
+# builds. The cycle count is the sum of the cycles of every instruction in
+# the function, i.e. one pass through its body with branches not taken and
+# without calls. It is not a trace of a real run, but it moves with the code
+# the compiler generates, which is what the comparison is after. Functions
+# that were inlined or removed show as "-".
+
+import argparse
+import re
+import sys
+
+# Cycles of the instructions that take more than one, for devices with a
+# 16 bit program counter. Skips and branches are counted as not taken.
+CYCLES = {
+	"adiw": 2, "sbiw": 2, "mul": 2, "muls": 2, "mulsu": 2, "fmul": 2,
+	"fmuls": 2, "fmulsu": 2, "rjmp": 2, "ijmp": 2, "eijmp": 2, "jmp": 3,
+	"rcall": 3, "icall": 3, "eicall": 4, "call": 4, "ret": 4, "reti": 4,
+	"ld": 2, "ldd": 2, "lds": 2, "st": 2, "std": 2, "sts": 2, "push": 2,
+	"pop": 2, "lpm": 3, "elpm": 3, "spm": 4, "cbi": 2, "sbi": 2,
+}
+
+# Devices with more than 128 KB of flash push a 3 byte return address
+BIG_PC = {"atmega2560", "atmega2561", "atmega1280", "atmega1281"}
+
+FUNCTION = re.compile(r"^([0-9a-f]+) <([^>]+)>:$")
+INSTRUCTION = re.compile(r"^\s+[0-9a-f]+:\t((?:[0-9a-f]{2} )+)\s*\t(\S+)")
+
+
+def cycles(mnemonic, big_pc):
+	count = CYCLES.get(mnemonic, 1)
+	if big_pc and mnemonic in ("rcall", "icall", "call", "ret", "reti"):
+		count += 1
+	return count
+
+
+# Get {function: (bytes, cycles)} from a listing
+def parse(path, big_pc):
+	functions = {}
+	name = None
+	with open(path, errors="replace") as listing:
+		for line in listing:
+			match = FUNCTION.match(line)
+			if match:
+				# LTO renames static functions, e.g. foo.lto_priv.0
+				name = match.group(2).split(".")[0]
+				functions.setdefault(name, [0, 0])
+				continue
+			match = INSTRUCTION.match(line)
+			if match and name:
+				functions[name][0] += len(match.group(1).split())
+				functions[name][1] += cycles(match.group(2), big_pc)
+	return {name: tuple(value) for name, value in functions.items()}
+
+
+def column(value):
+	return "-" if value is None else str(value)
+
+
+def main():
+	parser = argparse.ArgumentParser(
+		description="Compare the per-function size and cycles of two builds")
+	parser.add_argument("--mcu", default="atmega2560")
+	parser.add_argument("--all", action="store_true",
+		help="also list the functions that didn't change")
+	parser.add_argument("base", help="listing of the build to compare against")
+	parser.add_argument("new", help="listing of the build to report on")
+	args = parser.parse_args()
+
+	big_pc = args.mcu in BIG_PC
+	base = parse(args.base, big_pc)
+	new = parse(args.new, big_pc)
+
+	rows = []
+	for name in sorted(set(base) | set(new)):
+		old_size, old_cycles = base.get(name, (None, None))
+		new_size, new_cycles = new.get(name, (None, None))
+		if not args.all and (old_size, old_cycles) == (new_size, new_cycles):
+			continue
+		delta = (new_size or 0) - (old_size or 0)
+		rows.append((delta, name, old_size, new_size, old_cycles, new_cycles))
+	rows.sort(key=lambda row: (-abs(row[0]), row[1]))
+
+	print("%-32s %8s %8s %7s %8s %8s" %
+		("function", "bytes", "bytes", "delta", "cycles", "cycles"))
+	for delta, name, old_size, new_size, old_cycles, new_cycles in rows:
+		print("%-32s %8s %8s %+7d %8s %8s" % (name[:32], column(old_size),
+			column(new_size), delta, column(old_cycles), column(new_cycles)))
+
+	old_total = sum(size for size, _ in base.values())
+	new_total = sum(size for size, _ in new.values())
+	print("%-32s %8d %8d %+7d" % ("total", old_total, new_total,
+		new_total - old_total))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+#
+# stack_report.py
+#
+# Put the RAM use of both firmwares in one report: static RAM from the
+# section headers of the listing (.lss), the stack frame of every function
+# from the -fstack-usage files (.su) the Makefile has the compiler write,
+# and the deepest call chain from main() and from the ISRs found by
+# following the calls in the listing.
+#
+#   tools/stack_report.py build/Release/MotionAlarmMega:atmega2560 \
+#       build/Release/MotionAlarmUno:atmega328p
+#
+# With --console, the "mem" output of the debug console is read from a
+# capture of the debug port and the high-water marks measured on the boards
+# are shown next to the static figures.
+#
+# The static worst case is an estimate: calls through function pointers
+# can't be followed and are only flagged, frames come from the compile of
+# each file, so functions inlined by LTO show up under their callers'
+# names, and recursion is counted once.
+
+import argparse
+import glob
+import os
+import re
+import sys
+
+RAM = {"atmega2560": 8192, "atmega328p": 2048}
+BIG_PC = {"atmega2560", "atmega2561", "atmega1280", "atmega1281"}
+
+# Debug console "mem" lines of each board
+MEASURED = {
+	"atmega2560": re.compile(r"mega ram static \d+, stack peak (\d+)"),
+	"atmega328p": re.compile(r"uno stack (\d+) never used"),
+}
+
+SECTION = re.compile(r"^\s*\d+\s+(\.data|\.bss|\.noinit)\s+([0-9a-f]+)\s")
+FUNCTION = re.compile(r"^([0-9a-f]+) <([^>]+)>:$")
+CALL = re.compile(r"^\s+[0-9a-f]+:\t(?:[0-9a-f]{2} )+\s*\t(r?call|e?icall)\b(.*)$")
+TARGET = re.compile(r"<([^>+]+)")
+
+
+def base_name(name):
+	# LTO renames static functions, e.g. foo.lto_priv.0
+	return name.split(".")[0]
+
+
+# Get {function: (bytes, qualifiers)} from every .su file under a directory
+def read_frames(directory):
+	frames = {}
+	for path in glob.glob(os.path.join(directory, "**", "*.su"), recursive=True):
+		with open(path) as usage:
+			for line in usage:
+				fields = line.rstrip("\n").split("\t")
+				if len(fields) != 3:
+					continue
+				name = base_name(fields[0].rsplit(":", 1)[-1])
+				size = int(fields[1])
+				if size >= frames.get(name, (-1, ""))[0]:
+					frames[name] = (size, fields[2])
+	return frames
+
+
+# Get the static RAM and {function: (callees, indirect)} from a listing
+def read_listing(path):
+	static = 0
+	calls = {}
+	name = None
+	with open(path, errors="replace") as listing:
+		for line in listing:
+			match = SECTION.match(line)
+			if match:
+				static += int(match.group(2), 16)
+				continue
+			match = FUNCTION.match(line)
+			if match:
+				name = base_name(match.group(2))
+				calls.setdefault(name, [set(), False])
+				continue
+			match = CALL.match(line)
+			if match and name:
+				if match.group(1).endswith("icall"):
+					calls[name][1] = True
+					continue
+				target = TARGET.search(match.group(2))
+				# rcall .+0 only makes room on the stack
+				if target and base_name(target.group(1)) != name:
+					calls[name][0].add(base_name(target.group(1)))
+	return static, calls
+
+
+# Get the deepest stack use starting from a function, as (bytes, chain,
+# indirect), where indirect tells if calls through pointers were skipped
+def deepest(name, frames, calls, return_bytes, memo, active):
+	if name in memo:
+		return memo[name]
+	if name in active:
+		return (0, [name + " (recursion)"], False)
+	active.add(name)
+	callees, indirect = calls.get(name, (set(), False))
+	best = (0, [], False)
+	for callee in sorted(callees):
+		depth, chain, callee_indirect = deepest(callee, frames, calls,
+			return_bytes, memo, active)
+		indirect = indirect or callee_indirect
+		if depth + return_bytes > best[0]:
+			best = (depth + return_bytes, chain, False)
+	active.discard(name)
+	result = (frames.get(name, (0, ""))[0] + best[0], [name] + best[1], indirect)
+	memo[name] = result
+	return result
+
+
+# Get the last stack peak a board reported in the capture, the atmega328p
+# reports the bytes never used, which are taken off the room it has
+def measured(capture, mcu, room):
+	if not capture or mcu not in MEASURED:
+		return None
+	matches = MEASURED[mcu].findall(capture)
+	if not matches:
+		return None
+	if mcu == "atmega2560":
+		return int(matches[-1])
+	return room - int(matches[-1])
+
+
+def report(directory, mcu, capture, top):
+	name = os.path.basename(os.path.normpath(directory))
+	listings = glob.glob(os.path.join(directory, "*.lss"))
+	if not listings:
+		print("%s: no listing, build it first" % directory, file=sys.stderr)
+		return False
+	static, calls = read_listing(listings[0])
+	frames = read_frames(directory)
+	return_bytes = 3 if mcu in BIG_PC else 2
+	ram = RAM.get(mcu, 0)
+
+	print("%s (%s)" % (name, mcu))
+	print("  ram %d bytes, static %d, left for the stack %d" % (ram, static,
+		ram - static))
+	if not frames:
+		print("  no .su files, was it built with -fstack-usage?")
+		return True
+
+	memo = {}
+	depth, chain, indirect = deepest("main", frames, calls, return_bytes,
+		memo, set())
+	print("  main: %d bytes%s" % (depth, ", plus calls through pointers"
+		if indirect else ""))
+	print("    " + " > ".join(chain))
+
+	# ISRs don't nest, so only the deepest one adds to main
+	interrupt = (0, [], False)
+	for function in calls:
+		if function.startswith("__vector_"):
+			result = deepest(function, frames, calls, return_bytes, memo, set())
+			if result[0] + return_bytes > interrupt[0]:
+				interrupt = (result[0] + return_bytes,) + result[1:]
+	if interrupt[1]:
+		print("  deepest interrupt: %d bytes" % interrupt[0])
+		print("    " + " > ".join(interrupt[1]))
+	print("  static worst case: %d bytes" % (depth + interrupt[0]))
+
+	peak = measured(capture, mcu, ram - static)
+	if peak is not None:
+		print("  measured peak: %d bytes" % peak)
+
+	print("  largest frames:")
+	largest = sorted(frames.items(), key=lambda item: (-item[1][0], item[0]))
+	for function, (size, qualifiers) in largest[:top]:
+		print("    %6d  %-16s %s" % (size, qualifiers, function))
+	return True
+
+
+def main():
+	parser = argparse.ArgumentParser(
+		description="Static and measured RAM use of the firmwares")
+	parser.add_argument("targets", nargs="+", metavar="DIR:MCU",
+		help="build directory of a target and its device")
+	parser.add_argument("--console", help="capture of the debug console")
+	parser.add_argument("--top", type=int, default=10,
+		help="number of largest frames to list")
+	args = parser.parse_args()
+
+	capture = None
+	if args.console:
+		with open(args.console, errors="replace") as console:
+			capture = console.read()
+
+	ok = True
+	for target in args.targets:
+		directory, _, mcu = target.partition(":")
+		ok = report(directory, mcu or "atmega2560", capture, args.top) and ok
+	return 0 if ok else 1
+
+
+if __name__ == "__main__":
+	sys.exit(main())
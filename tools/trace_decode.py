@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+#
+# trace_decode.py
+#
+# Decode the binary trace the atmega2560 sends on its debug port (see
+# MotionAlarmMega/trace.h) into a timeline and latency histograms. Text the
+# firmware prints on the same port is shown in the timeline as it comes.
+#
+#   stty -F /dev/ttyUSB0 115200 raw
+#   cat /dev/ttyUSB0 > dump.bin            # or read the port directly
+#   tools/trace_decode.py dump.bin
+#   tools/trace_decode.py --latency key tx --latency tx rx dump.bin
+#
+# Histograms are printed for the time between successive events of each
+# type and for every --latency pair, measured from each event of the first
+# type to the next event of the second type.
+
+import argparse
+import struct
+import sys
+
+SYNC = b"\xa5\x5a"
+HEADER = struct.Struct("<IBH")
+RECORD = struct.Struct("<HBBH")
+TICK_US = 4
+
+# Event IDs from trace.h
+EVENTS = {
+	1: "state",
+	2: "key",
+	3: "echo",
+	4: "echo_lost",
+	5: "tx",
+	6: "rx",
+	7: "flush",
+	8: "entry",
+	9: "rtt",
+	10: "keyscan",
+}
+
+STATES = {246: "ARMED", 247: "MOVEMENT", 248: "DISARMED", 249: "TRIGGERED"}
+
+
+def describe(event, arg):
+	name = EVENTS.get(event, "event%d" % event)
+	if name == "state":
+		return "%-10s %s" % (name, STATES.get(arg, arg))
+	if name in ("key", "keyscan") and 32 <= arg < 127:
+		return "%-10s '%c'" % (name, arg)
+	if name == "echo":
+		return "%-10s %d us" % (name, arg * 16)
+	if name == "rtt":
+		return "%-10s %d us" % (name, arg * 16)
+	return "%-10s %d" % (name, arg)
+
+
+# Split the dump into text and frames, yielding ("text", str),
+# ("dropped", count) and ("event", time_us, id, arg) in order. Frames with
+# a bad checksum are reported and skipped.
+def decode(data):
+	position = 0
+	text = bytearray()
+	while position < len(data):
+		start = data.find(SYNC, position)
+		if start < 0:
+			text += data[position:]
+			break
+		text += data[position:start]
+		body = start + len(SYNC)
+		if body + HEADER.size > len(data):
+			break
+		frame_ms, count, dropped = HEADER.unpack_from(data, body)
+		end = body + HEADER.size + count * RECORD.size
+		if end >= len(data):
+			break
+		check = 0
+		for byte in data[body:end]:
+			check ^= byte
+		if check != data[end]:
+			yield ("text", "[bad trace frame at byte %d]" % start)
+			position = start + 1
+			continue
+
+		if text:
+			yield ("text", text.decode("ascii", "replace"))
+			text = bytearray()
+		if dropped:
+			yield ("dropped", dropped)
+		for i in range(count):
+			ms, ticks, event, arg = RECORD.unpack_from(data,
+				body + HEADER.size + i * RECORD.size)
+			# Records are older than the frame, extend their 16 bit time
+			full_ms = frame_ms - ((frame_ms - ms) & 0xFFFF)
+			yield ("event", full_ms * 1000 + ticks * TICK_US, event, arg)
+		position = end + 1
+	if text:
+		yield ("text", text.decode("ascii", "replace"))
+
+
+def histogram(title, values):
+	if not values:
+		return
+	values = sorted(values)
+	print("%s: %d samples, min %d us, median %d us, p95 %d us, max %d us" % (
+		title, len(values), values[0], values[len(values) // 2],
+		values[min(len(values) - 1, len(values) * 95 // 100)], values[-1]))
+	# Power of two buckets
+	buckets = {}
+	for value in values:
+		bucket = max(value, 1).bit_length() - 1
+		buckets[bucket] = buckets.get(bucket, 0) + 1
+	largest = max(buckets.values())
+	for bucket in range(min(buckets), max(buckets) + 1):
+		count = buckets.get(bucket, 0)
+		bar = "#" * (40 * count // largest) if count else ""
+		print("  %8d-%-8d us %6d %s" % (1 << bucket, (2 << bucket) - 1,
+			count, bar))
+
+
+def main():
+	parser = argparse.ArgumentParser(
+		description="Decode the atmega2560 trace into a timeline and histograms")
+	parser.add_argument("dump", help="raw capture of the debug port")
+	parser.add_argument("--latency", nargs=2, action="append", default=[],
+		metavar=("FROM", "TO"), help="event names, e.g. key tx")
+	parser.add_argument("--quiet", action="store_true",
+		help="print only the histograms")
+	args = parser.parse_args()
+
+	ids = {name: event for event, name in EVENTS.items()}
+	for pair in args.latency:
+		for name in pair:
+			if name not in ids:
+				parser.error("unknown event %s" % name)
+
+	with open(args.dump, "rb") as dump:
+		data = dump.read()
+
+	first = None
+	last = {}
+	intervals = {}
+	pending = {tuple(pair): [] for pair in args.latency}
+	latencies = {tuple(pair): [] for pair in args.latency}
+	for item in decode(data):
+		if item[0] == "dropped":
+			if not args.quiet:
+				print("%14s  [%d trace records dropped]" % ("", item[1]))
+			continue
+		if item[0] == "text":
+			if not args.quiet:
+				for line in item[1].splitlines():
+					if line.strip():
+						print("%14s  %s" % ("", line.strip()))
+			continue
+		_, time, event, arg = item
+		if first is None:
+			first = time
+		if not args.quiet:
+			print("%10d.%03d  %s" % ((time - first) // 1000,
+				(time - first) % 1000, describe(event, arg)))
+
+		name = EVENTS.get(event, "event%d" % event)
+		if name in last:
+			intervals.setdefault(name, []).append(time - last[name])
+		last[name] = time
+		for pair in pending:
+			if name == pair[1] and pending[pair]:
+				latencies[pair] += [time - start for start in pending[pair]]
+				pending[pair] = []
+			if name == pair[0]:
+				pending[pair].append(time)
+
+	print()
+	for name in sorted(intervals):
+		histogram("%s interval" % name, intervals[name])
+	for pair in latencies:
+		histogram("%s to %s" % pair, latencies[pair])
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())